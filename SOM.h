@@ -17,10 +17,20 @@
 #include <cstdlib>
 #include <ctime>
 #include <exception>
+#include <stdexcept>
 #include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <cmath>
+#include <limits>
+#include <map>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
 
 //include yaml-cpp library
 #include <yaml-cpp/yaml.h>
@@ -33,6 +43,24 @@
 //include rocksdb
 #include <rocksdb/db.h>
 #include <rocksdb/options.h>
+#include <rocksdb/write_batch.h>
+#include <cassert>
+#include <memory>
+#endif
+
+#ifndef ENABLE_SOM_PROFILING
+#define ENABLE_SOM_PROFILING 0
+#endif
+
+#if ENABLE_SOM_PROFILING
+#include "SOMProfiler.h"
+#define SOM_PROFILE_CONCAT_(a, b) a##b
+#define SOM_PROFILE_CONCAT(a, b) SOM_PROFILE_CONCAT_(a, b)
+/// opens a profiling span until the end of the enclosing scope.
+#define SOM_PROFILE_SCOPE(name) \
+	SOMProfiler::Span SOM_PROFILE_CONCAT(somProfileSpan, __LINE__)(name)
+#else
+#define SOM_PROFILE_SCOPE(name)
 #endif
 
 #ifndef M_PI
@@ -57,11 +85,13 @@ enum class BMDistType : unsigned char
 	/// </summary>
 	Uniform = 0,
 	/// <summary>
-	/// exponential decay
+	/// exponential decay with the lattice distance d to the BMU,
+	/// \f$ e^{-d/r} \f$ where r is the current neighborhood size.
 	/// </summary>
 	ExpDecay = 1,
 	/// <summary>
-	/// Gaussian distribution
+	/// Gaussian distribution, \f$ e^{-d^2/(2\sigma^2)} \f$ with
+	/// \f$ \sigma = r/2 \f$.
 	/// </summary>
 	Gaussian = 2
 };
@@ -122,6 +152,177 @@ enum class DistanceType : unsigned char
 	SquaredEuclidean = 3
 };
 
+/// <summary>
+/// Lattice topologies, which define the
+/// neighbors of a node on the SOM lattice.
+/// </summary>
+enum class LatticeTopology : unsigned char
+{
+	/// <summary>
+	/// Square grid, 4 neighbors (up, down, left, right).
+	/// </summary>
+	Rectangular = 0,
+	/// <summary>
+	/// Hexagonal grid, 6 neighbors.
+	/// Odd rows are shifted half a node to the right.
+	/// </summary>
+	Hexagonal = 1,
+	/// <summary>
+	/// Square grid wrapping around at the borders (torus).
+	/// </summary>
+	ToroidalRectangular = 2,
+	/// <summary>
+	/// Hexagonal grid wrapping around at the borders (torus),
+	/// requires an even #N of rows.
+	/// </summary>
+	ToroidalHexagonal = 3
+};
+
+/// <summary>
+/// Drift statistics of a warm-start update,
+/// see @SOM::update().
+/// </summary>
+struct SOMDriftStats
+{
+	/// <summary>
+	/// #N of new samples given.
+	/// </summary>
+	size_t samples = 0;
+	/// <summary>
+	/// #N of samples with a quantization error above the threshold.
+	/// </summary>
+	size_t selected = 0;
+	/// <summary>
+	/// #N of distinct samples used for fine-tuning, less than
+	/// @selected if there are fewer iterations than selected samples.
+	/// </summary>
+	size_t used = 0;
+	/// <summary>
+	/// mean quantization error of the new samples before the update.
+	/// </summary>
+	double meanErrorBefore = 0.0;
+	/// <summary>
+	/// mean quantization error of the new samples after the update.
+	/// </summary>
+	double meanErrorAfter = 0.0;
+	/// <summary>
+	/// mean euclidean distance nodes moved.
+	/// </summary>
+	double meanNodeShift = 0.0;
+	/// <summary>
+	/// max euclidean distance a node moved.
+	/// </summary>
+	double maxNodeShift = 0.0;
+};
+
+/// <summary>
+/// A level of multi-resolution training,
+/// see @SOM::trainMultiResolution().
+/// </summary>
+struct SOMTrainingLevel
+{
+	/// <summary>
+	/// lattice width of the level.
+	/// </summary>
+	int width = 0;
+	/// <summary>
+	/// lattice height of the level.
+	/// </summary>
+	int height = 0;
+	/// <summary>
+	/// #N of iterations of the level.
+	/// </summary>
+	unsigned int iterations = 0;
+	/// <summary>
+	/// starting learning rate of the level.
+	/// </summary>
+	double s_learn_rate = 0.0;
+	/// <summary>
+	/// ending learning rate of the level.
+	/// </summary>
+	double f_learn_rate = 0.0;
+	/// <summary>
+	/// starting neighborhood size of the level.
+	/// </summary>
+	double neighborhoodSize = 0.0;
+};
+
+/// <summary>
+/// Training progress stored in checkpoints,
+/// see @SOM::setCheckpointing().
+/// </summary>
+struct SOMTrainingState
+{
+	/// <summary>
+	/// next iteration to run.
+	/// </summary>
+	uint32_t nextIteration = 0;
+	/// <summary>
+	/// total #N of iterations.
+	/// </summary>
+	uint32_t iterations = 0;
+	/// <summary>
+	/// current learning rate minus the ending learning rate.
+	/// </summary>
+	double learnRateDiff = 0.0;
+	/// <summary>
+	/// ending learning rate.
+	/// </summary>
+	double finalLearnRate = 0.0;
+	/// <summary>
+	/// current neighborhood size.
+	/// </summary>
+	double neighborhoodSize = 0.0;
+};
+
+/// <summary>
+/// Counters of the pruned BMU search
+/// (see @SOM::enableBMUPruning()).
+/// </summary>
+struct BMUPruningStats
+{
+	/// <summary>
+	/// #N of BMU searches.
+	/// </summary>
+	unsigned long long searches = 0;
+	/// <summary>
+	/// #N of nodes considered over all searches.
+	/// </summary>
+	unsigned long long nodes = 0;
+	/// <summary>
+	/// #N of nodes skipped by the triangle inequality
+	/// bound without touching their weights.
+	/// </summary>
+	unsigned long long skipped = 0;
+	/// <summary>
+	/// #N of nodes whose partial distance exceeded
+	/// the current best before all D coordinates were summed.
+	/// </summary>
+	unsigned long long abandoned = 0;
+
+	/// <summary>
+	/// ratio of nodes skipped by the triangle inequality.
+	/// </summary>
+	double skipRate() const { return nodes ? skipped / static_cast<double>(nodes) : 0.0; }
+	/// <summary>
+	/// ratio of nodes abandoned early.
+	/// </summary>
+	double abandonRate() const { return nodes ? abandoned / static_cast<double>(nodes) : 0.0; }
+	/// <summary>
+	/// ratio of nodes which didn't need a full distance computation.
+	/// </summary>
+	double pruneRate() const { return nodes ? (skipped + abandoned) / static_cast<double>(nodes) : 0.0; }
+
+	BMUPruningStats &operator+=(const BMUPruningStats &other)
+	{
+		searches += other.searches;
+		nodes += other.nodes;
+		skipped += other.skipped;
+		abandoned += other.abandoned;
+		return *this;
+	}
+};
+
 /// <summary>
 /// Self-Organizing Maps implementation.
 /// </summary>
@@ -190,110 +391,390 @@ class SOM
 	/// <param name="iterations">#N of iterations</param>
 	/// <param name="s_learn_rate">starting learning_rate</param>
 	/// <param name="f_learn_rate">ending learning_rate</param>
-	/// <param name="neighborhoodSize">neighborhood size,
-	///  currently only sqare neighborhood is supported.</param>
+	/// <param name="neighborhoodSize">neighborhood size, i.e. radius of
+	///  the neighborhood on the lattice, see @setTopology().</param>
 	void train(const std::vector<std::vector<T>> &samples,
 			   unsigned int iterations, double s_learn_rate, double f_learn_rate,
 			   double neighborhoodSize)
 	{
-		//tot is total number of samples.
-		unsigned int tot = samples.size();
 		if (s_learn_rate < f_learn_rate)
 		{
 			f_learn_rate = 0;
 		}
 		double diffLR = s_learn_rate - f_learn_rate;
-		// if total number of samples (tot) is less than
-		// the number of iterations, then we use cyclic
-		// turn of samples.
-		bool less_samples = false;
-		if (tot < iterations)
-			less_samples = true;
-		for (unsigned int iter = 0; iter < iterations; ++iter)
-		{
-			diffLR *= (1.0 - iter / static_cast<double>(iterations));
-			double curr_learn_rate = f_learn_rate + diffLR;
-			neighborhoodSize *= (1.0 - iter / static_cast<double>(iterations));
-			int x = 0, y = 0;
+		trainFrom(samples, 0, iterations, diffLR, f_learn_rate, neighborhoodSize);
+	}
 
-			// we use cyclic repeat of samples
-			// if we don't have adequate samples.
-			// this is to avoid index out of range error.
-			int samples_idx = less_samples ? iter % samples.size() : iter;
-			calcBestMatchingUnit(samples[samples_idx], y, x);
-			int nSI = std::max(
-				static_cast<int>(round(neighborhoodSize)), 0);
-			int minX = std::max(0, x - nSI);
-			int minY = std::max(0, y - nSI);
-			int maxX = std::min(W - 1, x + nSI);
-			int maxY = std::min(H - 1, y + nSI);
+	/// <summary>
+	/// fine-tunes an already trained (or loaded) SOM on new samples
+	/// instead of training from scratch. A short schedule with small
+	/// learning rate and neighborhood size keeps the map disruption
+	/// bounded. Optionally, only the samples which are not represented
+	/// well by the current map (quantization error above the threshold)
+	/// are used. If there are fewer iterations than such samples, a
+	/// random subset of them (drawn with rand(), see srand()) is used.
+	/// </summary>
+	/// <param name="samples">new samples</param>
+	/// <param name="iterations">#N of iterations, 0 means one per used sample.</param>
+	/// <param name="s_learn_rate">starting learning_rate</param>
+	/// <param name="f_learn_rate">ending learning_rate</param>
+	/// <param name="neighborhoodSize">neighborhood size</param>
+	/// <param name="errorThreshold">samples with a quantization error
+	///  less or equal to this are skipped, 0 uses all samples.</param>
+	/// <returns>drift statistics of the update.</returns>
+	SOMDriftStats update(const std::vector<std::vector<T>> &samples,
+						 unsigned int iterations, double s_learn_rate, double f_learn_rate,
+						 double neighborhoodSize, T errorThreshold = static_cast<T>(0.0))
+	{
+		SOMDriftStats drift;
+		drift.samples = samples.size();
+		if (samples.empty())
+		{
+			return drift;
+		}
+		loadAllTiles();
 
-			//TODO: replace type check
-			//with function objects.
+		std::vector<T> errors = quantizationErrors(samples);
+		std::vector<std::vector<T>> selected;
+		for (size_t s = 0; s < samples.size(); ++s)
+		{
+			drift.meanErrorBefore += errors[s];
+			if (errorThreshold <= 0 || errors[s] > errorThreshold)
+			{
+				selected.push_back(samples[s]);
+			}
+		}
+		drift.meanErrorBefore /= samples.size();
+		drift.selected = selected.size();
 
-			//update weights of the BMU and its neighborhoods.
-			switch (bmdistType)
+		if (!selected.empty())
+		{
+			if (iterations == 0)
 			{
-			case BMDistType::Uniform:
+				iterations = static_cast<unsigned int>(selected.size());
+			}
+			if (iterations < selected.size())
 			{
-				for (int i = minY; i <= maxY; ++i)
-				{
-					for (int j = minX; j <= maxX; ++j)
-					{
-						T *const wi = nodeAt(i, j);
-						for (int k = 0; k < D; ++k)
-						{
-							T error = samples[samples_idx][k] - wi[k];
-							wi[k] += static_cast<T>(error * curr_learn_rate);
-						}
-					}
-				}
-				break;
+				// train() would only see the first samples
+				// in input order otherwise.
+				std::mt19937 rng(rand());
+				std::shuffle(selected.begin(), selected.end(), rng);
 			}
-			case BMDistType::ExpDecay:
+			drift.used = std::min<size_t>(iterations, selected.size());
+			const std::vector<T> before = weights;
+			train(selected, iterations, s_learn_rate, f_learn_rate, neighborhoodSize);
+			const int N = W * H;
+			for (int n = 0; n < N; ++n)
 			{
-				for (int i = minY; i <= maxY; ++i)
+				double shift = 0.0;
+				for (int k = 0; k < D; ++k)
 				{
-					for (int j = minX; j <= maxX; ++j)
-					{
-						T *const wi = nodeAt(i, j);
-						double _coef = exp((x - i) * (y - i) * (x - i) * (y - i) / (-2.0 * neighborhoodSize * neighborhoodSize));
-						for (int k = 0; k < D; ++k)
-						{
-							T error = samples[samples_idx][k] - wi[k];
-							wi[k] += static_cast<T>(error * curr_learn_rate * _coef);
-						}
-					}
+					double diff = weights[static_cast<size_t>(n) * D + k] - before[static_cast<size_t>(n) * D + k];
+					shift += diff * diff;
 				}
-				break;
+				shift = std::sqrt(shift);
+				drift.meanNodeShift += shift;
+				drift.maxNodeShift = std::max(drift.maxNodeShift, shift);
 			}
-			case BMDistType::Gaussian:
+			drift.meanNodeShift /= N;
+			errors = quantizationErrors(samples);
+		}
+		for (size_t s = 0; s < samples.size(); ++s)
+		{
+			drift.meanErrorAfter += errors[s];
+		}
+		drift.meanErrorAfter /= samples.size();
+		return drift;
+	}
+
+	/// <summary>
+	/// calculates quantization errors (distance to the BMU)
+	/// of the samples, in parallel.
+	/// </summary>
+	/// <param name="samples">input samples</param>
+	/// <returns>quantization error of each sample.</returns>
+	std::vector<T> quantizationErrors(const std::vector<std::vector<T>> &samples) const
+	{
+		// must not throw inside the parallel region.
+		requireLoaded();
+		for (const std::vector<T> &sample : samples)
+		{
+			if (sample.size() != static_cast<size_t>(D))
 			{
-				for (int i = minY; i <= maxY; ++i)
-				{
-					for (int j = minX; j <= maxX; ++j)
-					{
-						T *const wi = nodeAt(i, j);
-						T gaussian_coef = calcGaussian2D(x, y,
-														 static_cast<T>(neighborhoodSize / 2.0), j, i);
-						for (int k = 0; k < D; ++k)
-						{
-							T error = samples[samples_idx][k] - wi[k];
-							wi[k] += static_cast<T>(error * curr_learn_rate * gaussian_coef);
-						}
-					}
-				}
-				break;
+				throw std::runtime_error("input sample has different size than SOM");
+			}
+		}
+		std::vector<T> errors(samples.size());
+		const int n = static_cast<int>(samples.size());
+#pragma omp parallel
+		{
+			BMUPruningStats stats;
+#pragma omp for
+			for (int s = 0; s < n; ++s)
+			{
+				int y, x;
+				errors[s] = calcBestMatchingUnit(samples[s], y, x, stats);
+			}
+		}
+		return errors;
+	}
+
+	/// <summary>
+	/// trains the SOM coarse-to-fine. The map is resampled to the
+	/// lattice size of the first level and trained, then its codebook
+	/// is upsampled by bilinear interpolation to the next level's size
+	/// and training continues with that level's schedule, and so on.
+	/// Global ordering is done on the small lattices, where large
+	/// neighborhoods are cheap; later levels only need small radii.
+	/// Checkpoints (see @setCheckpointing()) are only written during
+	/// the last level, so @resumeTraining() always restores a lattice
+	/// of the final size and finishes the last level.
+	/// </summary>
+	/// <param name="samples">training samples, see @train()</param>
+	/// <param name="levels">levels from coarse to fine, the last level
+	///  must have the size of this SOM.</param>
+	void trainMultiResolution(const std::vector<std::vector<T>> &samples,
+							  const std::vector<SOMTrainingLevel> &levels)
+	{
+		if (levels.empty() || levels.back().width != W || levels.back().height != H)
+		{
+			throw std::invalid_argument("last training level must match the SOM lattice size");
+		}
+		// all levels are checked before the SOM is resized.
+		for (const SOMTrainingLevel &level : levels)
+		{
+			if (level.width <= 0 || level.height <= 0)
+			{
+				throw std::invalid_argument("lattice size must be positive");
+			}
+			if (latticeTopology == LatticeTopology::ToroidalHexagonal && level.height % 2 != 0)
+			{
+				throw std::invalid_argument("toroidal hexagonal lattice requires an even number of rows");
 			}
-			default:
+		}
+		const unsigned int every = checkpointEvery;
+		try
+		{
+			for (size_t l = 0; l < levels.size(); ++l)
 			{
-				break;
+				const SOMTrainingLevel &level = levels[l];
+				checkpointEvery = (l + 1 == levels.size()) ? every : 0;
+				resize(level.width, level.height);
+				train(samples, level.iterations, level.s_learn_rate,
+					  level.f_learn_rate, level.neighborhoodSize);
 			}
+		}
+		catch (...)
+		{
+			checkpointEvery = every;
+			throw;
+		}
+		checkpointEvery = every;
+	}
+
+	/// <summary>
+	/// resamples the codebook to a new lattice size by bilinear
+	/// interpolation of node weights. Corner nodes are kept in place.
+	/// </summary>
+	/// <param name="w">new width</param>
+	/// <param name="h">new height</param>
+	void resize(int w, int h)
+	{
+		if (w <= 0 || h <= 0)
+		{
+			throw std::invalid_argument("lattice size must be positive");
+		}
+		if (w == W && h == H)
+		{
+			return;
+		}
+		loadAllTiles();
+		std::vector<T> resized(static_cast<size_t>(w) * h * D);
+		const double sy = h > 1 ? (H - 1) / static_cast<double>(h - 1) : 0.0;
+		const double sx = w > 1 ? (W - 1) / static_cast<double>(w - 1) : 0.0;
+#pragma omp parallel for
+		for (int i = 0; i < h; ++i)
+		{
+			const double fy = i * sy;
+			const int y0 = std::min(static_cast<int>(fy), H - 1);
+			const int y1 = std::min(y0 + 1, H - 1);
+			const double ay = fy - y0;
+			for (int j = 0; j < w; ++j)
+			{
+				const double fx = j * sx;
+				const int x0 = std::min(static_cast<int>(fx), W - 1);
+				const int x1 = std::min(x0 + 1, W - 1);
+				const double ax = fx - x0;
+				const T *n00 = nodeAt(y0, x0);
+				const T *n01 = nodeAt(y0, x1);
+				const T *n10 = nodeAt(y1, x0);
+				const T *n11 = nodeAt(y1, x1);
+				T *dst = &resized[static_cast<size_t>(D) * (i * w + j)];
+				for (int k = 0; k < D; ++k)
+				{
+					dst[k] = static_cast<T>((1.0 - ay) * ((1.0 - ax) * n00[k] + ax * n01[k]) +
+											ay * ((1.0 - ax) * n10[k] + ax * n11[k]));
+				}
 			}
 		}
+		W = w;
+		H = h;
+		weights.swap(resized);
+		resetDerivedState();
+		refreshPruningBounds();
+	}
+
+	/// <summary>
+	/// get #N of node updates done by @train() so far, i.e. the sum
+	/// of neighborhood window sizes over all iterations.
+	/// </summary>
+	/// <returns>#N of node updates.</returns>
+	unsigned long long nodeUpdates() const { return nodeUpdateCount; }
+
+	/// <summary>
+	/// resets the node update counter, see @nodeUpdates().
+	/// </summary>
+	void resetNodeUpdates() { nodeUpdateCount = 0; }
+
+	/// <summary>
+	/// sets the lattice topology used by @train(). Rectangular
+	/// lattices use a square neighborhood, hexagonal lattices all
+	/// nodes within the hexagonal distance. Toroidal topologies wrap
+	/// around at the borders, so there are no edge effects.
+	/// </summary>
+	/// <param name="topology">lattice topology</param>
+	void setTopology(LatticeTopology topology)
+	{
+		if (topology == LatticeTopology::ToroidalHexagonal && H % 2 != 0)
+		{
+			throw std::invalid_argument("toroidal hexagonal lattice requires an even number of rows");
+		}
+		latticeTopology = topology;
+		neighborTables.clear();
+		uMatrixValid = false;
+	}
+
+	/// <summary>
+	/// get the lattice topology used by @train().
+	/// </summary>
+	/// <returns></returns>
+	LatticeTopology topology() const { return latticeTopology; }
+
+	/// <summary>
+	/// enables periodic checkpointing inside @train().
+	/// Every <c>every</c> iterations, weights and training state are
+	/// copied and written by a background thread to the given path
+	/// in binary form (see @saveCheckpoint()). The training loop only
+	/// pays for the copy; if the writer is still busy, the pending
+	/// snapshot is replaced by the newer one. Write errors don't stop
+	/// training, the first one is thrown by @train() when it is done.
+	/// </summary>
+	/// <param name="path">checkpoint file path</param>
+	/// <param name="every">checkpoint interval in iterations, 0 disables.</param>
+	void setCheckpointing(const std::string &path, unsigned int every)
+	{
+		checkpointPath = path;
+		checkpointEvery = every;
+	}
+
+	/// <summary>
+	/// resumes training from a checkpoint written by @train().
+	/// Weights, lattice parameters and the learning rate / neighborhood
+	/// schedule are restored, then the remaining iterations are run.
+	/// </summary>
+	/// <param name="checkpoint_path">checkpoint file path</param>
+	/// <param name="samples">the same training samples given to @train().</param>
+	void resumeTraining(const std::string &checkpoint_path,
+						const std::vector<std::vector<T>> &samples)
+	{
+		SOMTrainingState state = loadCheckpoint(checkpoint_path);
+		trainFrom(samples, state.nextIteration, state.iterations,
+				  state.learnRateDiff, state.finalLearnRate, state.neighborhoodSize);
+	}
+
+	/// <summary>
+	/// writes weights and training state to a binary checkpoint file.
+	/// The file is written to a temporary path and renamed, so an existing
+	/// checkpoint is never left half written. Values are stored in native
+	/// byte order.
+	/// </summary>
+	/// <param name="path">checkpoint file path</param>
+	/// <param name="state">training state</param>
+	void saveCheckpoint(const std::string &path, const SOMTrainingState &state) const
+	{
+		requireLoaded();
+		writeCheckpoint(path, W, H, D, distanceType, bmdistType, state, weights);
+	}
+
+	/// <summary>
+	/// loads weights and lattice parameters from a checkpoint file.
+	/// </summary>
+	/// <param name="path">checkpoint file path</param>
+	/// <returns>training state stored in the checkpoint.</returns>
+	SOMTrainingState loadCheckpoint(const std::string &path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+		{
+			throw std::runtime_error("cannot open checkpoint: " + path);
+		}
+		char magic[sizeof(CHECKPOINT_MAGIC)];
+		in.read(magic, sizeof(magic));
+		uint32_t valueSize = 0;
+		in.read(reinterpret_cast<char *>(&valueSize), sizeof(valueSize));
+		if (!in || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+			valueSize != sizeof(T))
+		{
+			throw std::runtime_error("invalid checkpoint: " + path);
+		}
+		int32_t dims[3];
+		unsigned char types[2];
+		SOMTrainingState state;
+		in.read(reinterpret_cast<char *>(dims), sizeof(dims));
+		in.read(reinterpret_cast<char *>(types), sizeof(types));
+		in.read(reinterpret_cast<char *>(&state), sizeof(state));
+		if (!in)
+		{
+			throw std::runtime_error("truncated checkpoint: " + path);
+		}
+		if (dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0 ||
+			state.nextIteration > state.iterations)
+		{
+			throw std::runtime_error("invalid checkpoint: " + path);
+		}
+		// the weights must be exactly the rest of the file,
+		// checked before allocating them.
+		const std::streamoff header = in.tellg();
+		in.seekg(0, std::ios::end);
+		const uint64_t values = static_cast<uint64_t>(in.tellg() - header) / sizeof(T);
+		in.seekg(header);
+		const uint64_t nodes = static_cast<uint64_t>(dims[0]) * static_cast<uint64_t>(dims[1]);
+		if (nodes > values / static_cast<uint64_t>(dims[2]) ||
+			nodes * static_cast<uint64_t>(dims[2]) != values)
+		{
+			throw std::runtime_error("truncated checkpoint: " + path);
+		}
+		std::vector<T> w(static_cast<size_t>(values));
+		in.read(reinterpret_cast<char *>(w.data()), w.size() * sizeof(T));
+		if (!in)
+		{
+			throw std::runtime_error("truncated checkpoint: " + path);
+		}
+		W = dims[0];
+		H = dims[1];
+		D = dims[2];
+		distanceType = static_cast<DistanceType>(types[0]);
+		bmdistType = static_cast<BMDistType>(types[1]);
+		weights.swap(w);
+		resetDerivedState();
+		refreshPruningBounds();
+		return state;
 	}
+
 	/// <summary>
-	/// clusters the input sample.
+	/// clusters the input sample. Once all tiles are loaded (see
+	/// @openLazy()) it doesn't modify the SOM, so it can be called
+	/// concurrently as long as the SOM isn't modified meanwhile.
 	/// </summary>
 	/// <param name="sample">input sample</param>
 	/// <returns> Winner neuron's weight vector,
@@ -301,6 +782,7 @@ class SOM
 	///  weights to input pattern. </returns>
 	std::vector<T> cluster(const std::vector<T> &sample)
 	{
+		loadAllTiles();
 		int x, y;
 		T dist = calcBestMatchingUnit(sample, y, x);
 		T *const res = nodeAt(y, x);
@@ -325,7 +807,11 @@ class SOM
 	/// <param name="i"> index of the first dimension (rows) of the SOM lattice.  </param>
 	/// <param name="j"> index of the second dimension (columns) of the SOM lattice.</param>
 	/// <returns>returns the pointer to Type T, which is the first
-	/// element in the weight (codebook) vector of the corresponding SOM node.</returns>
+	/// element in the weight (codebook) vector of the corresponding SOM node.
+	/// After @openLazy(), the node's tile must be loaded (see @loadRegion()).
+	/// With @enableBMUPruning(), writing through it leaves the pivot bounds
+	/// stale and BMU searches may be wrong until @updatePruningBounds()
+	/// is called; @setNodeAt() keeps them current.</returns>
 	inline T *const nodeAt(int i, int j) const
 	{
 		return const_cast<T *const>(&(weights[D * (i * W + j)]));
@@ -339,10 +825,36 @@ class SOM
 	/// <param name="val">value to set.</param>
 	inline void setNodeAt(int i, int j, const std::vector<T> &val)
 	{
+#if ENABLE_ROCKSDB
+		// the tile must be resident, otherwise loading it later
+		// would overwrite this write.
+		loadRegion(i, j, i, j);
+#endif
+		markDirty(i, j, i, j);
+#ifndef NDEBUG
+		if (pivotBoundsValid)
+			pivotWeightsChecksum -= nodeChecksum(i * W + j);
+#endif
 		for (int k = 0; k < D; ++k)
 		{
 			weights[D * (i * W + j) + k] = val[k];
 		}
+		if (pivotBoundsValid)
+		{
+			const int n = i * W + j;
+#ifndef NDEBUG
+			pivotWeightsChecksum += nodeChecksum(n);
+#endif
+			if (std::find(pivotIndices.begin(), pivotIndices.end(), n) != pivotIndices.end())
+			{
+				// a pivot moved, all of its distances change.
+				updatePruningBounds();
+			}
+			else
+			{
+				updatePivotDistances(n);
+			}
+		}
 	}
 
 	/// <summary>
@@ -353,6 +865,7 @@ class SOM
 	void load(const std::string &model_path,
 			  const SOMFileFormat &ff)
 	{
+		SOM_PROFILE_SCOPE("load");
 		switch (ff)
 		{
 		case SOMFileFormat::YAML:
@@ -363,64 +876,29 @@ class SOM
 			D = model["D"].as<int>();
 			distanceType = static_cast<DistanceType>(model["DistanceType"].as<unsigned char>());
 			bmdistType = static_cast<BMDistType>(model["BMDistType"].as<unsigned char>());
+			if (model["Topology"])
+			{
+				latticeTopology = static_cast<LatticeTopology>(model["Topology"].as<int>());
+			}
 			weights = model["weights"].as<std::vector<T>>();
+			resetDerivedState();
 
 			break;
 		}
 #if ENABLE_ROCKSDB
 		case SOMFileFormat::ROCKSDB:
 		{
-			rocksdb::DB *db;
-			rocksdb::Options options;
-			// Optimize RocksDB. This is the easiest way to get RocksDB to perform well
-			options.IncreaseParallelism();
-			options.OptimizeLevelStyleCompaction();
-
-			// open DB
-			rocksdb::Status s = rocksdb::DB::Open(options, model_path, &db);
-			assert(s.ok());
-			// get value
-			std::string w, h, d, bmdt, dt, strWeights;
-			s = db->Get(rocksdb::ReadOptions(), "W", &w);
-			W = std::stoi(w);
-			assert(s.ok());
-
-			s = db->Get(rocksdb::ReadOptions(), "H", &h);
-			H = std::stoi(h);
-			assert(s.ok());
-
-			s = db->Get(rocksdb::ReadOptions(), "D", &d);
-			D = std::stoi(d);
-			assert(s.ok());
-
-			s = db->Get(rocksdb::ReadOptions(), "DistanceType", &dt);
-			distanceType = static_cast<DistanceType>(std::stoi(dt));
-			assert(s.ok());
-
-			s = db->Get(rocksdb::ReadOptions(), "BMDistType", &bmdt);
-			bmdistType = static_cast<BMDistType>(std::stoi(bmdt));
-			assert(s.ok());
-			//get weights
-			s = db->Get(rocksdb::ReadOptions(), "weights", &strWeights);
-			assert(s.ok());
-			std::stringstream ss(strWeights);
-			//clear old weights, we will overwrite.
-			weights.clear();
-			T w_i;
-			while (ss >> w_i)
-			{
-				weights.push_back(w_i);
-				if (ss.peek() == ',')
-					ss.ignore();
-			}
+			openLazy(model_path);
+			loadRegion(0, 0, H - 1, W - 1);
 			//close db
-			delete db;
+			rocksDB.reset();
 			break;
 		}
 #endif
 		default:
 			break;
 		}
+		refreshPruningBounds();
 	}
 	/// <summary>
 	/// saves the trained SOM to the file.
@@ -430,11 +908,13 @@ class SOM
 	void save(const std::string &model_path,
 			  const SOMFileFormat &ff)
 	{
+		SOM_PROFILE_SCOPE("save");
 
 		switch (ff)
 		{
 		case SOMFileFormat::YAML:
 		{
+			loadAllTiles();
 			std::ofstream ofile;
 			ofile.open(model_path);
 			YAML::Emitter out;
@@ -455,6 +935,9 @@ class SOM
 			out << YAML::Key << "BMDistType";
 			out << YAML::Value << static_cast<unsigned char>(bmdistType);
 
+			out << YAML::Key << "Topology";
+			out << YAML::Value << static_cast<int>(latticeTopology);
+
 			out << YAML::Key << "weights";
 			out << YAML::Value;
 			out << YAML::BeginSeq;
@@ -469,50 +952,62 @@ class SOM
 #if ENABLE_ROCKSDB
 		case SOMFileFormat::ROCKSDB:
 		{
-			rocksdb::DB *db;
-			rocksdb::Options options;
-			// Optimize RocksDB. This is the easiest way to get RocksDB to perform well
-			options.IncreaseParallelism();
-			options.OptimizeLevelStyleCompaction();
-			// create the DB if it's not already present
-			options.create_if_missing = true;
-
-			// open DB
-			rocksdb::Status s = rocksdb::DB::Open(options, model_path, &db);
-			assert(s.ok());
-
-			s = db->Put(rocksdb::WriteOptions(), "BMDistType",
-						std::to_string(static_cast<unsigned char>(bmdistType)));
-			assert(s.ok());
-
-			s = db->Put(rocksdb::WriteOptions(), "D", std::to_string(D));
-			assert(s.ok());
-
-			s = db->Put(rocksdb::WriteOptions(), "DistanceType",
-						std::to_string(static_cast<unsigned char>(distanceType)));
-			assert(s.ok());
-
-			// Put H
-			s = db->Put(rocksdb::WriteOptions(), "H", std::to_string(H));
-			assert(s.ok());
-
-			// Put W
-			s = db->Put(rocksdb::WriteOptions(), "W", std::to_string(W));
-			assert(s.ok());
-
-			//put weights
-			std::stringstream ss;
-			ss << weights[0];
-			for (int i = 1; i < weights.size(); ++i)
+			std::shared_ptr<rocksdb::DB> db = openRocksDB(model_path, true);
+			// only tiles modified since the last save/load
+			// are written if the DB already holds this map.
+			const bool incremental = rocksDBSynced && rocksDBSyncedPath == model_path &&
+									 tileDirty.size() == static_cast<size_t>(tileRows() * tileCols());
+			if (!incremental)
 			{
-				ss << ',' << weights[i];
+				// tiles are read in the source layout, then
+				// written in the one for this D.
+				loadAllTiles();
+				rocksDBTileSide = 0;
+				rocksDBSynced = false;
 			}
-			//put weights of SOM
-			s = db->Put(rocksdb::WriteOptions(), "weights", ss.str());
-			assert(s.ok());
-			//close db
-			delete db;
-
+			rocksdb::WriteBatch batch;
+			batch.Put("BMDistType", std::to_string(static_cast<unsigned char>(bmdistType)));
+			batch.Put("Topology", std::to_string(static_cast<int>(latticeTopology)));
+			batch.Put("D", std::to_string(D));
+			batch.Put("DistanceType", std::to_string(static_cast<unsigned char>(distanceType)));
+			batch.Put("H", std::to_string(H));
+			batch.Put("W", std::to_string(W));
+			batch.Put("TileSize", std::to_string(tileSide()));
+			batch.Put("ValueSize", std::to_string(sizeof(T)));
+			if (!incremental)
+			{
+				// weights of the legacy (single string) layout.
+				batch.Delete("weights");
+			}
+			std::string tile;
+			for (int ti = 0; ti < tileRows(); ++ti)
+			{
+				for (int tj = 0; tj < tileCols(); ++tj)
+				{
+					const int t = ti * tileCols() + tj;
+					if (incremental && !tileDirty[t])
+						continue;
+					if (!tileLoaded.empty() && !tileLoaded[t])
+					{
+						loadRegion(ti * tileSide(), tj * tileSide(),
+								   ti * tileSide(), tj * tileSide());
+					}
+					encodeTile(ti, tj, tile);
+					batch.Put(tileKey(ti, tj), tile);
+					// keep batches bounded in memory.
+					if (batch.GetDataSize() >= ROCKSDB_BATCH_BYTES)
+					{
+						writeRocksDB(*db, batch, model_path);
+						batch.Clear();
+					}
+				}
+			}
+			writeRocksDB(*db, batch, model_path);
+			// dirty flags are only cleared once everything is written.
+			rocksDBTileSide = tileSide();
+			tileDirty.assign(static_cast<size_t>(tileRows() * tileCols()), 0);
+			rocksDBSynced = true;
+			rocksDBSyncedPath = model_path;
 			break;
 		}
 #endif
@@ -520,24 +1015,211 @@ class SOM
 			break;
 		}
 	}
+#if ENABLE_ROCKSDB
+	/// <summary>
+	/// opens a RocksDB model without loading weights.
+	/// Lattice parameters are read and weights are allocated,
+	/// tiles are read on demand by @loadRegion(). The DB stays open
+	/// until another model is loaded or the SOM is destroyed.
+	/// @setNodeAt() loads the tile it writes to. Operations which need
+	/// the whole codebook (@cluster(), @train(), @update(), @uMatrix(),
+	/// @resize(), @updatePruningBounds(), saving to YAML) load the
+	/// missing tiles first; const ones (@calcBestMatchingUnit(),
+	/// @calcBestMatchingUnits(), @quantizationErrors(), component
+	/// planes, checkpoints) throw while tiles are missing.
+	/// Models saved with the legacy single "weights" key are
+	/// loaded completely.
+	/// </summary>
+	/// <param name="model_path">model path</param>
+	void openLazy(const std::string &model_path)
+	{
+		// everything is read and checked before the SOM is changed,
+		// so it stays usable if this throws.
+		std::shared_ptr<rocksdb::DB> db = openRocksDB(model_path, false);
+		std::string w, h, d, bmdt, dt, tileSizeStr, topology;
+		readRocksDBKey(*db, "W", w, model_path);
+		readRocksDBKey(*db, "H", h, model_path);
+		readRocksDBKey(*db, "D", d, model_path);
+		readRocksDBKey(*db, "DistanceType", dt, model_path);
+		readRocksDBKey(*db, "BMDistType", bmdt, model_path);
+		const int newW = std::stoi(w), newH = std::stoi(h), newD = std::stoi(d);
+		if (newW <= 0 || newH <= 0 || newD <= 0)
+		{
+			throw std::runtime_error("invalid RocksDB model size: " + model_path);
+		}
+		// tiles are copied raw, so their layout must match
+		// before anything is decoded.
+		rocksdb::Status s = db->Get(rocksdb::ReadOptions(), "TileSize", &tileSizeStr);
+		const bool tiled = !s.IsNotFound();
+		int newTileSide = 0;
+		if (tiled)
+		{
+			std::string valueSize;
+			newTileSide = s.ok() ? std::stoi(tileSizeStr) : 0;
+			if (newTileSide <= 0)
+			{
+				throw std::runtime_error("invalid RocksDB tile size: " + model_path);
+			}
+			s = db->Get(rocksdb::ReadOptions(), "ValueSize", &valueSize);
+			if (!s.ok() || std::stoul(valueSize) != sizeof(T))
+			{
+				throw std::runtime_error("RocksDB model value type differs from SOM: " + model_path);
+			}
+		}
+		std::vector<T> legacyWeights;
+		if (!tiled)
+		{
+			//legacy layout: comma separated weights.
+			std::string strWeights;
+			readRocksDBKey(*db, "weights", strWeights, model_path);
+			std::stringstream ss(strWeights);
+			T w_i;
+			while (ss >> w_i)
+			{
+				legacyWeights.push_back(w_i);
+				if (ss.peek() == ',')
+					ss.ignore();
+			}
+		}
+		const bool hasTopology = db->Get(rocksdb::ReadOptions(), "Topology", &topology).ok();
+
+		W = newW;
+		H = newH;
+		D = newD;
+		distanceType = static_cast<DistanceType>(std::stoi(dt));
+		bmdistType = static_cast<BMDistType>(std::stoi(bmdt));
+		if (hasTopology)
+		{
+			latticeTopology = static_cast<LatticeTopology>(std::stoi(topology));
+		}
+		resetDerivedState();
+
+		if (!tiled)
+		{
+			weights.swap(legacyWeights);
+			refreshPruningBounds();
+			return;
+		}
+
+		rocksDBTileSide = newTileSide;
+		weights.assign(static_cast<size_t>(W) * H * D, static_cast<T>(0.0));
+		tileLoaded.assign(static_cast<size_t>(tileRows() * tileCols()), 0);
+		tileDirty.assign(static_cast<size_t>(tileRows() * tileCols()), 0);
+		rocksDB = db;
+		rocksDBPath = model_path;
+		rocksDBSynced = true;
+		rocksDBSyncedPath = model_path;
+	}
+
+	/// <summary>
+	/// reads the tiles covering the given lattice region from the
+	/// DB opened by @openLazy(). Already loaded tiles are not read again,
+	/// and modified tiles are never overwritten by their stored version.
+	/// </summary>
+	/// <param name="minY">first row of the region</param>
+	/// <param name="minX">first column of the region</param>
+	/// <param name="maxY">last row of the region (inclusive)</param>
+	/// <param name="maxX">last column of the region (inclusive)</param>
+	void loadRegion(int minY, int minX, int maxY, int maxX)
+	{
+		if (tileLoaded.empty())
+		{
+			//everything is resident.
+			return;
+		}
+		assert(rocksDB);
+		std::vector<std::pair<int, int>> missing;
+		std::vector<std::string> keys;
+		for (int ti = std::max(0, minY) / tileSide(); ti <= std::min(H - 1, maxY) / tileSide(); ++ti)
+		{
+			for (int tj = std::max(0, minX) / tileSide(); tj <= std::min(W - 1, maxX) / tileSide(); ++tj)
+			{
+				const int t = ti * tileCols() + tj;
+				if (tileLoaded[t])
+					continue;
+				if (tileDirty[t])
+				{
+					// written through @nodeAt() before being loaded,
+					// the resident weights are the newer ones.
+					tileLoaded[t] = 1;
+					continue;
+				}
+				missing.push_back(std::make_pair(ti, tj));
+				keys.push_back(tileKey(ti, tj));
+			}
+		}
+		if (keys.empty())
+		{
+			dropLoadedIfComplete();
+			return;
+		}
+		std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+		std::vector<std::string> values;
+		std::vector<rocksdb::Status> status =
+			rocksDB->MultiGet(rocksdb::ReadOptions(), slices, &values);
+		for (size_t n = 0; n < missing.size(); ++n)
+		{
+			if (!status[n].ok())
+			{
+				throw std::runtime_error("cannot read RocksDB tile " + keys[n]);
+			}
+			decodeTile(missing[n].first, missing[n].second, values[n]);
+			tileLoaded[missing[n].first * tileCols() + missing[n].second] = 1;
+		}
+		pivotBoundsValid = false;
+		markUMatrixDirty(minY, minX, maxY, maxX);
+		dropLoadedIfComplete();
+	}
+
+	/// <summary>
+	/// checks whether the tiles covering the region are loaded.
+	/// </summary>
+	/// <param name="minY">first row of the region</param>
+	/// <param name="minX">first column of the region</param>
+	/// <param name="maxY">last row of the region (inclusive)</param>
+	/// <param name="maxX">last column of the region (inclusive)</param>
+	/// <returns>true if all weights of the region are resident.</returns>
+	bool isRegionLoaded(int minY, int minX, int maxY, int maxX) const
+	{
+		if (tileLoaded.empty())
+			return true;
+		for (int ti = std::max(0, minY) / tileSide(); ti <= std::min(H - 1, maxY) / tileSide(); ++ti)
+		{
+			for (int tj = std::max(0, minX) / tileSide(); tj <= std::min(W - 1, maxX) / tileSide(); ++tj)
+			{
+				if (!tileLoaded[ti * tileCols() + tj])
+					return false;
+			}
+		}
+		return true;
+	}
+#endif
+
 	/// <summary>
 	/// get #N of columns (width) of SOM lattice
 	/// </summary>
 	/// <returns></returns>
-	int cols() { return W; }
+	int cols() const { return W; }
 	/// <summary>
 	/// get #N of rows (height) of SOM lattice
 	/// </summary>
 	/// <returns></returns>
-	int rows() { return H; }
+	int rows() const { return H; }
 	/// <summary>
 	/// get dimensions (codebook vector size) of SOM
 	/// </summary>
 	/// <returns></returns>
-	int dims() { return D; }
+	int dims() const { return D; }
+	/// <summary>
+	/// get distance metric used for BMU search
+	/// </summary>
+	/// <returns></returns>
+	DistanceType distanceMetric() const { return distanceType; }
 
 	/// <summary>
 	/// calculates Best Matching Unit (winning neuron).
+	/// Pruning counters are not kept, see the overload
+	/// taking @BMUPruningStats.
 	/// </summary>
 	/// <param name="sample">input sample</param>
 	/// <param name="y">index of the 0th dimension (rows) of the
@@ -548,155 +1230,1509 @@ class SOM
 	T calcBestMatchingUnit(const std::vector<T> &sample,
 						   int &y, int &x) const
 	{
+		BMUPruningStats stats;
+		return calcBestMatchingUnit(sample, y, x, stats);
+	}
+
+	/// <summary>
+	/// calculates Best Matching Unit (winning neuron).
+	/// Pruning counters are accumulated into the given
+	/// stats, so concurrent callers can keep their own counters.
+	/// </summary>
+	/// <param name="sample">input sample</param>
+	/// <param name="y">index of the 0th dimension (rows) of the
+	/// winning neuron </param>
+	/// <param name="x">index of the 1th dimension (columns) of the
+	/// winning neuron </param>
+	/// <param name="stats">pruning counters to update</param>
+	/// <returns> distance between BMU and sample </returns>
+	T calcBestMatchingUnit(const std::vector<T> &sample,
+						   int &y, int &x, BMUPruningStats &stats) const
+	{
+		SOM_PROFILE_SCOPE("bmu");
 		if (sample.size() != D)
 		{
-			throw std::runtime_error("input sample has different size than SOM");
+			throw std::runtime_error("input sample has different size than SOM");
+		}
+		requireLoaded();
+
+		T minDist = std::numeric_limits<T>::max();
+		int min_i = 0, min_j = 0;
+
+		if (bmuPruning && (distanceType == DistanceType::Euclidean ||
+						   distanceType == DistanceType::SquaredEuclidean))
+		{
+			return prunedBestMatchingUnit(sample, y, x, stats);
+		}
+
+		switch (distanceType)
+		{
+		case DistanceType::Euclidean:
+		{
+			for (int i = 0; i < H; ++i)
+			{
+				for (int j = 0; j < W; ++j)
+				{
+					T dist = euclideanDistance(sample, nodeAt(i, j));
+					if (dist < minDist)
+					{
+						minDist = dist;
+						min_i = i;
+						min_j = j;
+					}
+				}
+			}
+			break;
+		}
+		case DistanceType::DotProduct:
+		{
+			for (int i = 0; i < H; ++i)
+			{
+				for (int j = 0; j < W; ++j)
+				{
+					T dist = dotProduct(sample, nodeAt(i, j));
+					//convert similarity to distance.
+					dist = 1.0 / (1.0 + dist);
+					if (dist < minDist)
+					{
+						minDist = dist;
+						min_i = i;
+						min_j = j;
+					}
+				}
+			}
+			break;
+		}
+		case DistanceType::CosineSimiarity:
+		{
+			for (int i = 0; i < H; ++i)
+			{
+				for (int j = 0; j < W; ++j)
+				{
+					T dist = cosineSimilarity(sample, nodeAt(i, j));
+					//convert similarity to distance.
+					dist = 1.0 / (1.0 + dist);
+					if (dist < minDist)
+					{
+						minDist = dist;
+						min_i = i;
+						min_j = j;
+					}
+				}
+			}
+			break;
+		}
+		case DistanceType::SquaredEuclidean:
+		{
+			for (int i = 0; i < H; ++i)
+			{
+				for (int j = 0; j < W; ++j)
+				{
+					T dist = squaredEuclideanDistance(sample, nodeAt(i, j));
+					if (dist < minDist)
+					{
+						minDist = dist;
+						min_i = i;
+						min_j = j;
+					}
+				}
+			}
+			break;
+		}
+		default:
+		{
+			break;
+		}
+		} //end of switch-case
+
+		y = min_i;
+		x = min_j;
+		return minDist;
+	} //end of the method calcBestMatchingUnit()
+
+	/// <summary>
+	/// calculates Best Matching Units of a batch of samples.
+	/// For Euclidean and SquaredEuclidean metrics (without pruning)
+	/// the lattice is scanned in blocks of nodes, and each block is
+	/// matched against all samples while it is in cache. Other metrics
+	/// fall back to @calcBestMatchingUnit() per sample.
+	/// </summary>
+	/// <param name="samples">input samples</param>
+	/// <param name="ys">rows of the winning neurons</param>
+	/// <param name="xs">columns of the winning neurons</param>
+	/// <param name="dists">distances between BMUs and samples</param>
+	/// <param name="stats">pruning counters to update</param>
+	void calcBestMatchingUnits(const std::vector<const std::vector<T> *> &samples,
+							   std::vector<int> &ys, std::vector<int> &xs,
+							   std::vector<T> &dists, BMUPruningStats &stats) const
+	{
+		SOM_PROFILE_SCOPE("bmu_batch");
+		requireLoaded();
+		const size_t n = samples.size();
+		ys.assign(n, 0);
+		xs.assign(n, 0);
+		dists.assign(n, std::numeric_limits<T>::max());
+		if (bmuPruning || (distanceType != DistanceType::Euclidean &&
+						   distanceType != DistanceType::SquaredEuclidean))
+		{
+			for (size_t s = 0; s < n; ++s)
+			{
+				dists[s] = calcBestMatchingUnit(*samples[s], ys[s], xs[s], stats);
+			}
+			return;
+		}
+		for (size_t s = 0; s < n; ++s)
+		{
+			if (samples[s]->size() != static_cast<size_t>(D))
+			{
+				throw std::runtime_error("input sample has different size than SOM");
+			}
+		}
+
+		const int N = W * H;
+		std::vector<int> best(n, 0);
+		for (int n0 = 0; n0 < N; n0 += BATCH_NODE_BLOCK)
+		{
+			const int n1 = std::min(N, n0 + BATCH_NODE_BLOCK);
+			for (size_t s = 0; s < n; ++s)
+			{
+				const T *sv = samples[s]->data();
+				for (int node = n0; node < n1; ++node)
+				{
+					const T *nv = &weights[static_cast<size_t>(D) * node];
+					T sum = static_cast<T>(0.0);
+					for (int k = 0; k < D; ++k)
+					{
+						sum += (sv[k] - nv[k]) * (sv[k] - nv[k]);
+					}
+					if (sum < dists[s])
+					{
+						dists[s] = sum;
+						best[s] = node;
+					}
+				}
+			}
+		}
+		for (size_t s = 0; s < n; ++s)
+		{
+			ys[s] = best[s] / W;
+			xs[s] = best[s] % W;
+			if (distanceType == DistanceType::Euclidean)
+			{
+				dists[s] = sqrt(dists[s]);
+			}
+		}
+	}
+
+	/// <summary>
+	/// enables (or disables) exact pruning in the BMU search.
+	/// Only Euclidean and SquaredEuclidean metrics are pruned:
+	/// squared distances are compared and a node's distance is
+	/// abandoned once its partial sum exceeds the current best.
+	/// Additionally, distances of all nodes to a few pivot nodes
+	/// are precomputed, and a node \f$c\f$ is skipped when
+	/// \f$ |d(x,p)-d(c,p)| \f$ for any pivot \f$p\f$ is already
+	/// larger than the current best distance (triangle inequality).
+	/// The pivot bounds are built here and rebuilt after @train(),
+	/// @resize() and loading, and @setNodeAt() keeps them current,
+	/// so BMU searches only read them. Until they are rebuilt (e.g.
+	/// during training) searches are pruned by partial distances only.
+	/// Writes through @nodeAt() are not tracked: call
+	/// @updatePruningBounds() after them, otherwise the search is no
+	/// longer exact. Debug builds detect such writes and skip the
+	/// bounds instead.
+	/// </summary>
+	/// <param name="enable">enable or disable pruning</param>
+	/// <param name="nPivots">#N of pivot nodes for the triangle
+	///  inequality bounds, 0 disables the bounds.</param>
+	void enableBMUPruning(bool enable, int nPivots = 8)
+	{
+		bmuPruning = enable;
+		numPivots = std::max(0, std::min(nPivots, W * H));
+		pivotBoundsValid = false;
+		pivotIndices.clear();
+		pivotDistances.clear();
+		resetPruningStats();
+		refreshPruningBounds();
+	}
+
+	/// <summary>
+	/// (re)computes distances between all nodes and the pivot nodes,
+	/// which are used for the triangle inequality bounds.
+	/// Must be called after modifying weights through @nodeAt(),
+	/// stale bounds make pruned BMU searches return wrong nodes.
+	/// </summary>
+	void updatePruningBounds()
+	{
+#if ENABLE_ROCKSDB
+		loadRegion(0, 0, H - 1, W - 1);
+#endif
+		pivotIndices.clear();
+		pivotDistances.clear();
+		pivotBoundsValid = false;
+		if (numPivots <= 0)
+		{
+			return;
+		}
+		// pivots are spread evenly on the lattice,
+		// as a trained map is topologically ordered.
+		int gx = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(numPivots))));
+		int gy = (numPivots + gx - 1) / gx;
+		for (int a = 0; a < gy; ++a)
+		{
+			for (int b = 0; b < gx; ++b)
+			{
+				if (static_cast<int>(pivotIndices.size()) == numPivots)
+					break;
+				int pi = std::min(H - 1, (2 * a + 1) * H / (2 * gy));
+				int pj = std::min(W - 1, (2 * b + 1) * W / (2 * gx));
+				int idx = pi * W + pj;
+				if (std::find(pivotIndices.begin(), pivotIndices.end(), idx) == pivotIndices.end())
+					pivotIndices.push_back(idx);
+			}
+		}
+		const int P = static_cast<int>(pivotIndices.size());
+		const int N = W * H;
+		pivotDistances.resize(static_cast<size_t>(N) * P);
+#pragma omp parallel for
+		for (int n = 0; n < N; ++n)
+		{
+			updatePivotDistances(n);
+		}
+#ifndef NDEBUG
+		pivotWeightsChecksum = weightsChecksum();
+#endif
+		pivotBoundsValid = true;
+	}
+
+	/// <summary>
+	/// get the counters of the pruned BMU searches of @train().
+	/// Other searches only count into the stats passed to
+	/// @calcBestMatchingUnit(), so concurrent callers don't share them.
+	/// </summary>
+	/// <returns>pruning counters since the last reset.</returns>
+	const BMUPruningStats &pruningStats() const { return pruneStats; }
+
+	/// <summary>
+	/// resets the counters of the pruned BMU search.
+	/// </summary>
+	void resetPruningStats() { pruneStats = BMUPruningStats(); }
+
+	/// <summary>
+	/// get the U-matrix (unified distance matrix) of the SOM.
+	/// Each value is the average euclidean distance between a node
+	/// and its neighbors on the lattice, stored row major (H x W).
+	/// Only the nodes around the regions modified since the last
+	/// call (see @markDirty()) are recomputed, rows are
+	/// processed in parallel.
+	/// </summary>
+	/// <param name="topology">lattice topology defining the neighbors.</param>
+	/// <returns>U-matrix with the size of H*W.</returns>
+	const std::vector<T> &uMatrix(LatticeTopology topology)
+	{
+		loadAllTiles();
+		if (!uMatrixValid || uMatrixTopology != topology ||
+			uMatrixCache.size() != static_cast<size_t>(W) * H)
+		{
+			uMatrixCache.assign(static_cast<size_t>(W) * H, static_cast<T>(0.0));
+			uMatrixTopology = topology;
+			markDirty(0, 0, H - 1, W - 1);
+		}
+
+		// a node's U-value depends on its neighbors, which are at
+		// most 1 row and 1 column away, so dirty ranges are grown by 1.
+		// On toroidal lattices neighbors wrap around the borders.
+		const bool toroidal = isToroidal(topology);
+		std::vector<int> fromCol(H, W), toCol(H, -1);
+		for (int i = 0; i < H; ++i)
+		{
+			for (int d = -1; d <= 1; ++d)
+			{
+				int r = i + d;
+				if (toroidal)
+					r = r < 0 ? r + H : (r >= H ? r - H : r);
+				else if (r < 0 || r >= H)
+					continue;
+				if (dirtyMinCol[r] <= dirtyMaxCol[r])
+				{
+					bool wraps = toroidal && (dirtyMinCol[r] == 0 || dirtyMaxCol[r] == W - 1);
+					fromCol[i] = wraps ? 0 : std::min(fromCol[i], std::max(0, dirtyMinCol[r] - 1));
+					toCol[i] = wraps ? W - 1 : std::max(toCol[i], std::min(W - 1, dirtyMaxCol[r] + 1));
+				}
+			}
+		}
+
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < H; ++i)
+		{
+			for (int j = fromCol[i]; j <= toCol[i]; ++j)
+			{
+				uMatrixCache[i * W + j] = uMatrixValue(i, j, topology);
+			}
+		}
+
+		std::fill(dirtyMinCol.begin(), dirtyMinCol.end(), W);
+		std::fill(dirtyMaxCol.begin(), dirtyMaxCol.end(), -1);
+		uMatrixValid = true;
+		return uMatrixCache;
+	}
+
+	/// <summary>
+	/// get the U-matrix of the SOM for the lattice topology
+	/// used by @train(), see @uMatrix(LatticeTopology).
+	/// </summary>
+	/// <returns>U-matrix with the size of H*W.</returns>
+	const std::vector<T> &uMatrix()
+	{
+		return uMatrix(latticeTopology);
+	}
+
+	/// <summary>
+	/// extracts the component plane of the given dimension,
+	/// i.e. the k-th weight of each node, stored row major (H x W).
+	/// </summary>
+	/// <param name="k">index of the dimension (codebook element).</param>
+	/// <returns>component plane with the size of H*W.</returns>
+	std::vector<T> componentPlane(int k) const
+	{
+		if (k < 0 || k >= D)
+		{
+			throw std::out_of_range("component index is out of range");
+		}
+		requireLoaded();
+		std::vector<T> plane(static_cast<size_t>(W) * H);
+#pragma omp parallel for
+		for (int i = 0; i < H; ++i)
+		{
+			for (int j = 0; j < W; ++j)
+			{
+				plane[i * W + j] = nodeAt(i, j)[k];
+			}
+		}
+		return plane;
+	}
+
+	/// <summary>
+	/// extracts the component planes of all dimensions.
+	/// </summary>
+	/// <returns>D component planes, each with the size of H*W.</returns>
+	std::vector<std::vector<T>> componentPlanes() const
+	{
+		requireLoaded();
+		std::vector<std::vector<T>> planes(D, std::vector<T>(static_cast<size_t>(W) * H));
+#pragma omp parallel for
+		for (int i = 0; i < H; ++i)
+		{
+			for (int j = 0; j < W; ++j)
+			{
+				const T *node = nodeAt(i, j);
+				for (int k = 0; k < D; ++k)
+				{
+					planes[k][i * W + j] = node[k];
+				}
+			}
+		}
+		return planes;
+	}
+
+	/// <summary>
+	/// marks the rectangular lattice region as modified, so that
+	/// the next @uMatrix() call recomputes it. @train() and
+	/// @setNodeAt() do this automatically; call it after modifying
+	/// weights through @nodeAt().
+	/// </summary>
+	/// <param name="minY">first row of the region</param>
+	/// <param name="minX">first column of the region</param>
+	/// <param name="maxY">last row of the region (inclusive)</param>
+	/// <param name="maxX">last column of the region (inclusive)</param>
+	void markDirty(int minY, int minX, int maxY, int maxX)
+	{
+		markUMatrixDirty(minY, minX, maxY, maxX);
+#if ENABLE_ROCKSDB
+		if (tileDirty.size() != static_cast<size_t>(tileRows() * tileCols()))
+		{
+			tileDirty.assign(static_cast<size_t>(tileRows() * tileCols()), 1);
+		}
+		for (int ti = std::max(0, minY) / tileSide(); ti <= std::min(H - 1, maxY) / tileSide(); ++ti)
+		{
+			for (int tj = std::max(0, minX) / tileSide(); tj <= std::min(W - 1, maxX) / tileSide(); ++tj)
+			{
+				tileDirty[ti * tileCols() + tj] = 1;
+			}
+		}
+#endif
+	}
+
+  private:
+	/// <summary>
+	/// marks the region as modified for the U-matrix only,
+	/// see @markDirty().
+	/// </summary>
+	void markUMatrixDirty(int minY, int minX, int maxY, int maxX)
+	{
+		if (dirtyMinCol.size() != static_cast<size_t>(H))
+		{
+			dirtyMinCol.assign(H, W);
+			dirtyMaxCol.assign(H, -1);
+		}
+		for (int i = std::max(0, minY); i <= std::min(H - 1, maxY); ++i)
+		{
+			dirtyMinCol[i] = std::min(dirtyMinCol[i], std::max(0, minX));
+			dirtyMaxCol[i] = std::max(dirtyMaxCol[i], std::min(W - 1, maxX));
+		}
+	}
+
+	/// <summary>
+	/// drops state derived from weights (pivot bounds,
+	/// U-matrix, storage sync) after weights are replaced.
+	/// </summary>
+	void resetDerivedState()
+	{
+		pivotBoundsValid = false;
+		uMatrixValid = false;
+		neighborTables.clear();
+#if ENABLE_ROCKSDB
+		rocksDB.reset();
+		rocksDBSynced = false;
+		rocksDBTileSide = 0;
+		tileLoaded.clear();
+		tileDirty.clear();
+#endif
+	}
+
+	/// <summary>
+	/// loads the tiles which are not resident yet, see @openLazy().
+	/// </summary>
+	void loadAllTiles()
+	{
+#if ENABLE_ROCKSDB
+		if (tileLoaded.empty())
+			return;
+		loadRegion(0, 0, H - 1, W - 1);
+		refreshPruningBounds();
+#endif
+	}
+
+	/// <summary>
+	/// throws if some tiles are not resident, for const
+	/// operations which need the whole codebook.
+	/// </summary>
+	void requireLoaded() const
+	{
+#if ENABLE_ROCKSDB
+		if (!tileLoaded.empty())
+		{
+			throw std::logic_error("SOM is partially loaded, call loadRegion() first");
+		}
+#endif
+	}
+
+	/// <summary>
+	/// rebuilds stale pivot bounds if pruning is enabled and all
+	/// tiles are loaded, so BMU searches never have to.
+	/// </summary>
+	void refreshPruningBounds()
+	{
+		if (!bmuPruning || pivotBoundsValid)
+			return;
+#if ENABLE_ROCKSDB
+		if (!tileLoaded.empty())
+			return;
+#endif
+		updatePruningBounds();
+	}
+
+	/// <summary>
+	/// computes the distances between a node and the pivots.
+	/// </summary>
+	/// <param name="n">node index (i * W + j)</param>
+	void updatePivotDistances(int n)
+	{
+		const int P = static_cast<int>(pivotIndices.size());
+		const T *nv = &weights[static_cast<size_t>(D) * n];
+		for (int p = 0; p < P; ++p)
+		{
+			const T *pv = &weights[static_cast<size_t>(D) * pivotIndices[p]];
+			T sum = static_cast<T>(0.0);
+			for (int k = 0; k < D; ++k)
+			{
+				sum += (pv[k] - nv[k]) * (pv[k] - nv[k]);
+			}
+			pivotDistances[static_cast<size_t>(n) * P + p] = sqrt(sum);
+		}
+	}
+
+#ifndef NDEBUG
+	/// <summary>
+	/// checksum of a node's weights: the bit patterns of its values,
+	/// weighted by their position, so that any single change shows.
+	/// </summary>
+	/// <param name="n">node index (i * W + j)</param>
+	uint64_t nodeChecksum(int n) const
+	{
+		uint64_t sum = 0;
+		const size_t base = static_cast<size_t>(D) * n;
+		for (int k = 0; k < D; ++k)
+		{
+			uint64_t bits = 0;
+			std::memcpy(&bits, &weights[base + k], std::min(sizeof(T), sizeof(bits)));
+			sum += bits * (base + k + 1);
+		}
+		return sum;
+	}
+
+	/// <summary>
+	/// checksum of all weights, the sum of @nodeChecksum() over nodes.
+	/// </summary>
+	uint64_t weightsChecksum() const
+	{
+		uint64_t sum = 0;
+		for (int n = 0; n < W * H; ++n)
+		{
+			sum += nodeChecksum(n);
+		}
+		return sum;
+	}
+#endif
+
+#if ENABLE_ROCKSDB
+	/// <summary>
+	/// tile size (in nodes, per side) of the RocksDB layout: the one
+	/// of the opened/saved DB, otherwise the largest tile within
+	/// ROCKSDB_TILE_BYTES (at most ROCKSDB_MAX_TILE).
+	/// </summary>
+	int tileSide() const
+	{
+		if (rocksDBTileSide > 0)
+			return rocksDBTileSide;
+		const size_t nodeBytes = std::max<size_t>(1, static_cast<size_t>(D) * sizeof(T));
+		const int side = static_cast<int>(std::sqrt(static_cast<double>(ROCKSDB_TILE_BYTES / nodeBytes)));
+		const int maxSide = ROCKSDB_MAX_TILE;
+		return std::max(1, std::min(maxSide, side));
+	}
+
+	/// <summary>
+	/// #N of tile rows of the RocksDB layout.
+	/// </summary>
+	int tileRows() const { return (H + tileSide() - 1) / tileSide(); }
+	/// <summary>
+	/// #N of tile columns of the RocksDB layout.
+	/// </summary>
+	int tileCols() const { return (W + tileSide() - 1) / tileSide(); }
+
+	/// <summary>
+	/// key of the tile at given tile indices.
+	/// </summary>
+	static std::string tileKey(int ti, int tj)
+	{
+		return "tile/" + std::to_string(ti) + "/" + std::to_string(tj);
+	}
+
+	/// <summary>
+	/// serializes the weights of a tile as raw binary rows
+	/// (the tile is clipped at the lattice border).
+	/// </summary>
+	void encodeTile(int ti, int tj, std::string &out) const
+	{
+		const int i0 = ti * tileSide(), i1 = std::min(H, i0 + tileSide());
+		const int j0 = tj * tileSide(), j1 = std::min(W, j0 + tileSide());
+		const size_t rowBytes = static_cast<size_t>(j1 - j0) * D * sizeof(T);
+		out.resize((i1 - i0) * rowBytes);
+		for (int i = i0; i < i1; ++i)
+		{
+			std::memcpy(&out[(i - i0) * rowBytes], nodeAt(i, j0), rowBytes);
+		}
+	}
+
+	/// <summary>
+	/// clears @tileLoaded once every tile is resident.
+	/// </summary>
+	void dropLoadedIfComplete()
+	{
+		if (std::find(tileLoaded.begin(), tileLoaded.end(), 0) == tileLoaded.end())
+		{
+			tileLoaded.clear();
+		}
+	}
+
+	/// <summary>
+	/// copies the weights of a serialized tile, see @encodeTile().
+	/// </summary>
+	void decodeTile(int ti, int tj, const std::string &in)
+	{
+		const int i0 = ti * tileSide(), i1 = std::min(H, i0 + tileSide());
+		const int j0 = tj * tileSide(), j1 = std::min(W, j0 + tileSide());
+		const size_t rowBytes = static_cast<size_t>(j1 - j0) * D * sizeof(T);
+		if (in.size() != (i1 - i0) * rowBytes)
+		{
+			throw std::runtime_error("RocksDB tile " + tileKey(ti, tj) + " has unexpected size");
+		}
+		for (int i = i0; i < i1; ++i)
+		{
+			std::memcpy(nodeAt(i, j0), &in[(i - i0) * rowBytes], rowBytes);
+		}
+	}
+
+	/// <summary>
+	/// opens the DB at given path, reusing the DB opened by
+	/// @openLazy() if the path matches.
+	/// </summary>
+	std::shared_ptr<rocksdb::DB> openRocksDB(const std::string &path, bool createIfMissing)
+	{
+		if (rocksDB && rocksDBPath == path)
+		{
+			return rocksDB;
+		}
+		rocksdb::DB *db;
+		rocksdb::Options options;
+		// Optimize RocksDB. This is the easiest way to get RocksDB to perform well
+		options.IncreaseParallelism();
+		options.OptimizeLevelStyleCompaction();
+		options.create_if_missing = createIfMissing;
+
+		// open DB
+		rocksdb::Status s = rocksdb::DB::Open(options, path, &db);
+		if (!s.ok())
+		{
+			throw std::runtime_error("cannot open RocksDB: " + path);
+		}
+		return std::shared_ptr<rocksdb::DB>(db);
+	}
+
+	/// <summary>
+	/// reads a required key of a RocksDB model.
+	/// </summary>
+	static void readRocksDBKey(rocksdb::DB &db, const std::string &key,
+							   std::string &value, const std::string &path)
+	{
+		if (!db.Get(rocksdb::ReadOptions(), key, &value).ok())
+		{
+			throw std::runtime_error("cannot read " + key + " of RocksDB model: " + path);
+		}
+	}
+
+	/// <summary>
+	/// writes a batch, throwing on failure.
+	/// </summary>
+	static void writeRocksDB(rocksdb::DB &db, rocksdb::WriteBatch &batch, const std::string &path)
+	{
+		if (!db.Write(rocksdb::WriteOptions(), &batch).ok())
+		{
+			throw std::runtime_error("cannot write RocksDB model: " + path);
+		}
+	}
+#endif
+
+  public:
+	friend YAML::Emitter &operator<<(YAML::Emitter &out, const SOM<T> &som)
+	{
+		som.requireLoaded();
+		out << YAML::BeginMap;
+		out << YAML::Key << "W";
+		out << YAML::Value << som.W;
+
+		out << YAML::Key << "H";
+		out << YAML::Value << som.H;
+
+		out << YAML::Key << "D";
+		out << YAML::Value << som.D;
+
+		out << YAML::Key << "DistanceType";
+		out << YAML::Value << static_cast<unsigned char>(som.distanceType);
+
+		out << YAML::Key << "BMDistType";
+		out << YAML::Value << static_cast<unsigned char>(som.bmdistType);
+
+		out << YAML::Key << "Topology";
+		out << YAML::Value << static_cast<int>(som.latticeTopology);
+
+		out << YAML::Key << "weights";
+		out << YAML::Value;
+		out << YAML::Flow << som.weights;
+		out << YAML::EndMap;
+
+		return out;
+	}
+	friend void operator>>(const YAML::Node &node, SOM<T> &som)
+	{
+		som.W = node["W"].as<int>();
+		som.H = node["H"].as<int>();
+		som.D = node["D"].as<int>();
+		som.distanceType = static_cast<DistanceType>(node["DistanceType"].as<unsigned char>());
+		som.bmdistType = static_cast<BMDistType>(node["BMDistType"].as<unsigned char>());
+		if (node["Topology"])
+		{
+			som.latticeTopology = static_cast<LatticeTopology>(node["Topology"].as<int>());
+		}
+		YAML::Node weights = node["weights"];
+		som.weights.resize(weights.size());
+#pragma omp parallel for
+		for (int i = 0; i < weights.size(); ++i)
+		{
+			som.weights[i] = weights[i].as<T>();
+		}
+		som.resetDerivedState();
+		som.refreshPruningBounds();
+	}
+
+  private:
+	/// <summary>
+	/// runs the training loop from the given iteration
+	/// with the given schedule state, see @train().
+	/// </summary>
+	/// <param name="samples">training samples</param>
+	/// <param name="startIter">first iteration to run</param>
+	/// <param name="iterations">total #N of iterations</param>
+	/// <param name="diffLR">current learning rate above f_learn_rate</param>
+	/// <param name="f_learn_rate">ending learning_rate</param>
+	/// <param name="neighborhoodSize">current neighborhood size</param>
+	void trainFrom(const std::vector<std::vector<T>> &samples,
+				   unsigned int startIter, unsigned int iterations,
+				   double diffLR, double f_learn_rate, double neighborhoodSize)
+	{
+		//tot is total number of samples.
+		unsigned int tot = samples.size();
+		// if total number of samples (tot) is less than
+		// the number of iterations, then we use cyclic
+		// turn of samples.
+		SOM_PROFILE_SCOPE("train");
+		bool less_samples = false;
+		if (tot < iterations)
+			less_samples = true;
+		// every BMU search scans the whole codebook.
+		loadAllTiles();
+		// weights are going to change, pivot bounds get stale.
+		pivotBoundsValid = false;
+		CheckpointWriter writer(checkpointEvery > 0 ? checkpointPath : std::string());
+		for (unsigned int iter = startIter; iter < iterations; ++iter)
+		{
+			diffLR *= (1.0 - iter / static_cast<double>(iterations));
+			double curr_learn_rate = f_learn_rate + diffLR;
+			neighborhoodSize *= (1.0 - iter / static_cast<double>(iterations));
+			int x = 0, y = 0;
+
+			// we use cyclic repeat of samples
+			// if we don't have adequate samples.
+			// this is to avoid index out of range error.
+			int samples_idx = less_samples ? iter % samples.size() : iter;
+			calcBestMatchingUnit(samples[samples_idx], y, x, pruneStats);
+			int nSI = std::max(
+				static_cast<int>(round(neighborhoodSize)), 0);
+
+			//update weights of the BMU and its neighborhoods.
+			{
+				SOM_PROFILE_SCOPE("neighborhood");
+				updateNeighborhood(neighborTable(nSI), y, x, samples[samples_idx],
+								   curr_learn_rate, neighborhoodSize);
+			}
+
+			if (checkpointEvery > 0 && (iter + 1) % checkpointEvery == 0)
+			{
+				SOM_PROFILE_SCOPE("checkpoint");
+				SOMTrainingState state;
+				state.nextIteration = iter + 1;
+				state.iterations = iterations;
+				state.learnRateDiff = diffLR;
+				state.finalLearnRate = f_learn_rate;
+				state.neighborhoodSize = neighborhoodSize;
+				writer.post(*this, state);
+			}
+		}
+		refreshPruningBounds();
+		// flushes the last posted checkpoint and reports write errors.
+		writer.finish();
+	}
+
+	/// <summary>
+	/// writes a binary checkpoint, see @saveCheckpoint().
+	/// </summary>
+	static void writeCheckpoint(const std::string &path, int w, int h, int d,
+								DistanceType dt, BMDistType bmdt,
+								const SOMTrainingState &state,
+								const std::vector<T> &weights)
+	{
+		std::string tmpPath = path + ".tmp";
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			uint32_t valueSize = sizeof(T);
+			int32_t dims[3] = {w, h, d};
+			unsigned char types[2] = {static_cast<unsigned char>(dt),
+									  static_cast<unsigned char>(bmdt)};
+			out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+			out.write(reinterpret_cast<const char *>(&valueSize), sizeof(valueSize));
+			out.write(reinterpret_cast<const char *>(dims), sizeof(dims));
+			out.write(reinterpret_cast<const char *>(types), sizeof(types));
+			out.write(reinterpret_cast<const char *>(&state), sizeof(state));
+			out.write(reinterpret_cast<const char *>(weights.data()), weights.size() * sizeof(T));
+			out.flush();
+			if (!out)
+			{
+				throw std::runtime_error("cannot write checkpoint: " + tmpPath);
+			}
+		}
+		if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+		{
+			throw std::runtime_error("cannot rename checkpoint: " + path);
+		}
+	}
+
+	/// <summary>
+	/// Background checkpoint writer used by @train().
+	/// The training thread copies the weights into the pending
+	/// snapshot; the writer thread swaps it out and writes it.
+	/// The writer is joined (after flushing) on destruction.
+	/// </summary>
+	class CheckpointWriter
+	{
+	  public:
+		explicit CheckpointWriter(const std::string &path) : path(path)
+		{
+			if (!path.empty())
+			{
+				worker = std::thread(&CheckpointWriter::run, this);
+			}
+		}
+
+		~CheckpointWriter()
+		{
+			if (worker.joinable())
+			{
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					stopping = true;
+				}
+				cv.notify_one();
+				worker.join();
+			}
+		}
+
+		/// <summary>
+		/// flushes the last posted snapshot, joins the writer and
+		/// rethrows the first write error, if any.
+		/// </summary>
+		void finish()
+		{
+			if (worker.joinable())
+			{
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					stopping = true;
+				}
+				cv.notify_one();
+				worker.join();
+			}
+			if (error)
+			{
+				std::rethrow_exception(error);
+			}
+		}
+
+		/// <summary>
+		/// posts a snapshot of the SOM, costs a copy of the weights.
+		/// </summary>
+		void post(const SOM<T> &som, const SOMTrainingState &state)
+		{
+			if (!worker.joinable())
+				return;
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				pending.assign(som.weights.begin(), som.weights.end());
+				pendingState = state;
+				w = som.W;
+				h = som.H;
+				d = som.D;
+				dt = som.distanceType;
+				bmdt = som.bmdistType;
+				hasPending = true;
+			}
+			cv.notify_one();
+		}
+
+	  private:
+		void run()
+		{
+			std::vector<T> snapshot;
+			for (;;)
+			{
+				SOMTrainingState state;
+				int sw, sh, sd;
+				DistanceType sdt;
+				BMDistType sbmdt;
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					cv.wait(lock, [this] { return hasPending || stopping; });
+					if (!hasPending)
+						return;
+					snapshot.swap(pending);
+					state = pendingState;
+					sw = w;
+					sh = h;
+					sd = d;
+					sdt = dt;
+					sbmdt = bmdt;
+					hasPending = false;
+				}
+				try
+				{
+					writeCheckpoint(path, sw, sh, sd, sdt, sbmdt, state, snapshot);
+				}
+				catch (...)
+				{
+					// training goes on, the first error is
+					// rethrown by finish() when it is done.
+					std::lock_guard<std::mutex> lock(mtx);
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+		}
+
+		std::string path;
+		std::thread worker;
+		std::mutex mtx;
+		std::condition_variable cv;
+		std::vector<T> pending;
+		SOMTrainingState pendingState;
+		int w = 0, h = 0, d = 0;
+		DistanceType dt = DistanceType::Euclidean;
+		BMDistType bmdt = BMDistType::Uniform;
+		bool hasPending = false;
+		bool stopping = false;
+		std::exception_ptr error;
+	};
+
+	/// <summary>
+	/// calculates Euclidean Distance between 2 vectors.
+	/// </summary>
+	/// <param name="v1">vector 1</param>
+	/// <param name="v2">vector 2</param>
+	/// <returns>euclidean distance</returns>
+	inline T euclideanDistance(const std::vector<T> &v1,
+							   const std::vector<T> &v2) const
+	{
+		T sum = static_cast<T>(0.0);
+		for (int i = 0; i < v1.size(); ++i)
+		{
+			sum += (v1[i] - v2[i]) * (v1[i] - v2[i]);
+		}
+		return sqrt(sum);
+	}
+	/// <summary>
+	/// calculates squared euclidean distance between 2 vectors.
+	/// </summary>
+	/// <param name="v1">vector 1</param>
+	/// <param name="v2">vector 2</param>
+	/// <returns>euclidean distance</returns>
+	inline T squaredEuclideanDistance(const std::vector<T> &v1,
+									  const std::vector<T> &v2) const
+	{
+		T sum = static_cast<T>(0.0);
+		for (int i = 0; i < v1.size(); ++i)
+		{
+			sum += (v1[i] - v2[i]) * (v1[i] - v2[i]);
+		}
+		return sum;
+	}
+	/// <summary>
+	/// calculates squared euclidean distance between 2 vectors.
+	/// This method overloads @squaredEuclideanDistance()
+	/// as second parameter is pointer to T for
+	/// performance reasons.
+	/// </summary>
+	/// <param name="v1">vector 1</param>
+	/// <param name="v2">vector 2</param>
+	/// <returns>squared euclidean distance</returns>
+	inline T squaredEuclideanDistance(const std::vector<T> &v1,
+									  const T *v2) const
+	{
+		T sum = static_cast<T>(0.0);
+		for (size_t i = 0; i < v1.size(); ++i)
+		{
+			sum += (v1[i] - v2[i]) * (v1[i] - v2[i]);
+		}
+		return sum;
+	}
+	/// <summary>
+	/// calculates squared euclidean distance between 2 vectors,
+	/// stopping as soon as the partial sum exceeds the bound.
+	/// Coordinates are summed in blocks of @PDS_BLOCK so that the
+	/// inner loop stays vectorizable; the bound is checked per block.
+	/// </summary>
+	/// <param name="v1">vector 1</param>
+	/// <param name="v2">vector 2</param>
+	/// <param name="bound">abandoning bound</param>
+	/// <param name="abandoned">set to true if the sum exceeded the bound
+	/// before all coordinates were summed.</param>
+	/// <returns>squared euclidean distance, or a partial sum
+	///  larger than bound.</returns>
+	inline T partialSquaredEuclideanDistance(const T *v1, const T *v2,
+											 T bound, bool &abandoned) const
+	{
+		T sum = static_cast<T>(0.0);
+		int k = 0;
+		abandoned = false;
+		for (; k + PDS_BLOCK <= D; k += PDS_BLOCK)
+		{
+			T block = static_cast<T>(0.0);
+			for (int b = 0; b < PDS_BLOCK; ++b)
+			{
+				T diff = v1[k + b] - v2[k + b];
+				block += diff * diff;
+			}
+			sum += block;
+			if (sum > bound)
+			{
+				abandoned = (k + PDS_BLOCK < D);
+				return sum;
+			}
+		}
+		for (; k < D; ++k)
+		{
+			sum += (v1[k] - v2[k]) * (v1[k] - v2[k]);
+		}
+		return sum;
+	}
+	/// <summary>
+	/// exact BMU search for Euclidean and SquaredEuclidean metrics
+	/// using partial distances and pivot triangle inequality bounds.
+	/// see @enableBMUPruning().
+	/// </summary>
+	/// <param name="sample">input sample</param>
+	/// <param name="y">row of the winning neuron</param>
+	/// <param name="x">column of the winning neuron</param>
+	/// <param name="stats">pruning counters to update</param>
+	/// <returns> distance between BMU and sample </returns>
+	T prunedBestMatchingUnit(const std::vector<T> &sample,
+							 int &y, int &x, BMUPruningStats &stats) const
+	{
+		const int N = W * H;
+		const T *s = sample.data();
+		T bestSq = std::numeric_limits<T>::max();
+		int best = 0;
+		bool abandoned;
+
+		bool useBounds = pivotBoundsValid &&
+						 pivotDistances.size() == static_cast<size_t>(N) * pivotIndices.size();
+#ifndef NDEBUG
+		// weights written through nodeAt() without
+		// updatePruningBounds(), the bounds would prune wrongly.
+		if (useBounds && weightsChecksum() != pivotWeightsChecksum)
+		{
+			std::cerr << "SOM: stale pivot bounds, call updatePruningBounds() "
+						 "after writing through nodeAt()"
+					  << std::endl;
+			useBounds = false;
+		}
+#endif
+		const int P = useBounds ? static_cast<int>(pivotIndices.size()) : 0;
+		// distances of the sample to the pivots, the nearest
+		// pivot is the starting best candidate.
+		std::vector<T> sampleToPivot(P);
+		for (int p = 0; p < P; ++p)
+		{
+			int idx = pivotIndices[p];
+			T dsq = squaredEuclideanDistance(sample, &weights[static_cast<size_t>(D) * idx]);
+			sampleToPivot[p] = sqrt(dsq);
+			if (dsq < bestSq || (dsq == bestSq && idx < best))
+			{
+				bestSq = dsq;
+				best = idx;
+			}
+		}
+		// relative slack which keeps the bound
+		// conservative against rounding errors.
+		const T slack = static_cast<T>(1.0) + 64 * std::numeric_limits<T>::epsilon();
+
+		for (int n = 0; n < N; ++n)
+		{
+			if (P > 0)
+			{
+				const T *pd = &pivotDistances[static_cast<size_t>(n) * P];
+				T lb = static_cast<T>(0.0);
+				for (int p = 0; p < P; ++p)
+				{
+					lb = std::max(lb, static_cast<T>(std::fabs(sampleToPivot[p] - pd[p])));
+				}
+				if (lb * lb > bestSq * slack)
+				{
+					++stats.skipped;
+					continue;
+				}
+			}
+			T dsq = partialSquaredEuclideanDistance(s, &weights[static_cast<size_t>(D) * n],
+													bestSq, abandoned);
+			if (abandoned)
+			{
+				++stats.abandoned;
+				continue;
+			}
+			// ties are resolved to the lowest index, as in
+			// the exhaustive search.
+			if (dsq < bestSq || (dsq == bestSq && n < best))
+			{
+				bestSq = dsq;
+				best = n;
+			}
+		}
+		++stats.searches;
+		stats.nodes += N;
+
+		y = best / W;
+		x = best % W;
+		return distanceType == DistanceType::Euclidean ? static_cast<T>(sqrt(bestSq)) : bestSq;
+	}
+	/// <summary>
+	/// whether the topology is hexagonal.
+	/// </summary>
+	static bool isHexagonal(LatticeTopology topology)
+	{
+		return topology == LatticeTopology::Hexagonal ||
+			   topology == LatticeTopology::ToroidalHexagonal;
+	}
+
+	/// <summary>
+	/// whether the topology wraps around at the borders.
+	/// </summary>
+	static bool isToroidal(LatticeTopology topology)
+	{
+		return topology == LatticeTopology::ToroidalRectangular ||
+			   topology == LatticeTopology::ToroidalHexagonal;
+	}
+
+	/// <summary>
+	/// A contiguous run of nodes in a row of a neighborhood,
+	/// relative to the BMU.
+	/// </summary>
+	struct NeighborRun
+	{
+		/// row offset
+		int dy;
+		/// column offset of the first node
+		int dxBegin;
+		/// #N of nodes
+		int count;
+		/// index of the first node in NeighborTable::classes
+		int classBegin;
+	};
+
+	/// <summary>
+	/// Precomputed neighborhood of a radius on the lattice.
+	/// Nodes are grouped into row runs, and each node refers to
+	/// the class of its lattice distance to the BMU, so coefficients
+	/// are computed once per distinct distance (see @updateNeighborhood()).
+	/// Hexagonal lattices have separate lists for even and odd BMU rows.
+	/// </summary>
+	struct NeighborTable
+	{
+		std::vector<NeighborRun> runs[2];
+		std::vector<int> classes[2];
+		/// squared lattice distance of each class
+		std::vector<double> dist2;
+	};
+
+	/// <summary>
+	/// get the neighborhood table of the radius, building it
+	/// on first use for the current topology and lattice size.
+	/// </summary>
+	/// <param name="radius">neighborhood radius</param>
+	/// <returns>neighborhood table</returns>
+	const NeighborTable &neighborTable(int radius)
+	{
+		// no need for radii beyond the lattice, hex distances
+		// can exceed its width and height.
+		radius = std::min(radius, isHexagonal(latticeTopology) ? W + H : std::max(W, H));
+		typename std::map<int, NeighborTable>::iterator it = neighborTables.find(radius);
+		if (it != neighborTables.end())
+		{
+			return it->second;
+		}
+		if (neighborTables.size() >= NEIGHBOR_TABLE_CACHE)
+		{
+			neighborTables.clear();
+		}
+		if (latticeTopology == LatticeTopology::ToroidalHexagonal && H % 2 != 0)
+		{
+			throw std::logic_error("toroidal hexagonal lattice requires an even number of rows");
 		}
 
-		T minDist = std::numeric_limits<T>::max();
-		int min_i = 0, min_j = 0;
-
-		switch (distanceType)
-		{
-		case DistanceType::Euclidean:
+		NeighborTable &table = neighborTables[radius];
+		const bool hex = isHexagonal(latticeTopology);
+		const bool toroidal = isToroidal(latticeTopology);
+		// on a torus, every node is visited once through its offset in
+		// [-(S - 1) / 2, S / 2], which includes the antipodal row/column
+		// of even sizes. Other offsets would reach the same nodes again.
+		// Rows farther than the radius are never within it.
+		const int minDy = toroidal ? -std::min(radius, (H - 1) / 2) : -radius;
+		const int maxDy = toroidal ? std::min(radius, H / 2) : radius;
+		// hex rows are only a part of [-r - 1, r + 1], rect rows all of [-r, r].
+		const int minDx = toroidal ? -(W - 1) / 2 : -radius - 1;
+		const int maxDx = toroidal ? W / 2 : radius + 1;
+		std::map<long long, int> classOf;
+
+		for (int parity = 0; parity < (hex ? 2 : 1); ++parity)
 		{
-			for (int i = 0; i < H; ++i)
+			for (int dy = minDy; dy <= maxDy; ++dy)
 			{
-				for (int j = 0; j < W; ++j)
+				NeighborRun run;
+				run.dy = dy;
+				run.count = 0;
+				for (int dx = minDx; dx <= maxDx; ++dx)
 				{
-					T dist = euclideanDistance(sample, nodeAt(i, j));
-					if (dist < minDist)
+					long long key;
+					if (!neighborKey(parity, dy, dx, radius, key))
 					{
-						minDist = dist;
-						min_i = i;
-						min_j = j;
+						// rows of a hex torus may have gaps, close the run.
+						if (run.count > 0)
+							table.runs[parity].push_back(run);
+						run.count = 0;
+						continue;
 					}
-				}
-			}
-			break;
-		}
-		case DistanceType::DotProduct:
-		{
-			for (int i = 0; i < H; ++i)
-			{
-				for (int j = 0; j < W; ++j)
-				{
-					T dist = dotProduct(sample, nodeAt(i, j));
-					//convert similarity to distance.
-					dist = 1.0 / (1.0 + dist);
-					if (dist < minDist)
+					if (run.count == 0)
 					{
-						minDist = dist;
-						min_i = i;
-						min_j = j;
+						run.dxBegin = dx;
+						run.classBegin = static_cast<int>(table.classes[parity].size());
+					}
+					++run.count;
+					std::map<long long, int>::iterator c = classOf.find(key);
+					if (c == classOf.end())
+					{
+						c = classOf.insert(std::make_pair(key, static_cast<int>(table.dist2.size()))).first;
+						table.dist2.push_back(key / 4.0);
 					}
+					table.classes[parity].push_back(c->second);
 				}
+				if (run.count > 0)
+					table.runs[parity].push_back(run);
 			}
-			break;
 		}
-		case DistanceType::CosineSimiarity:
+		return table;
+	}
+
+	/// <summary>
+	/// checks whether the node at the given offset from a BMU (in a row
+	/// of the given parity) is within the radius, and computes its
+	/// distance class key, 4 * squared distance, which is an integer
+	/// for both lattices (hex rows are sqrt(3)/2 apart). Rectangular
+	/// neighborhoods are squares, hexagonal ones use the hex distance.
+	/// On a torus the nearest wrapped copy of the offset is used.
+	/// </summary>
+	/// <param name="parity">row parity of the BMU (hex lattices)</param>
+	/// <param name="dy">row offset</param>
+	/// <param name="dx">column offset</param>
+	/// <param name="radius">neighborhood radius</param>
+	/// <param name="key">distance class key</param>
+	/// <returns>true if the node is within the radius.</returns>
+	bool neighborKey(int parity, int dy, int dx, int radius, long long &key) const
+	{
+		const bool hex = isHexagonal(latticeTopology);
+		const int wraps = isToroidal(latticeTopology) ? 1 : 0;
+		int best = std::numeric_limits<int>::max();
+		for (int a = -wraps; a <= wraps; ++a)
 		{
-			for (int i = 0; i < H; ++i)
+			for (int b = -wraps; b <= wraps; ++b)
 			{
-				for (int j = 0; j < W; ++j)
+				const long long oy = dy + a * H, ox = dx + b * W;
+				long long dist, k;
+				if (hex)
 				{
-					T dist = cosineSimilarity(sample, nodeAt(i, j));
-					//convert similarity to distance.
-					dist = 1.0 / (1.0 + dist);
-					if (dist < minDist)
-					{
-						minDist = dist;
-						min_i = i;
-						min_j = j;
-					}
+					// axial coordinates of odd-r offset coordinates.
+					// H is even on a torus, so the row parity is kept.
+					const long long row = parity + oy;
+					const long long dq = ox - (floorDiv2(static_cast<int>(row)) - floorDiv2(parity));
+					dist = (std::llabs(dq) + std::llabs(oy) + std::llabs(dq + oy)) / 2;
+					// doubled horizontal offset of node centers.
+					const long long dX2 = 2 * ox + (row & 1) - parity;
+					k = dX2 * dX2 + 3 * oy * oy;
+				}
+				else
+				{
+					dist = std::max(std::llabs(ox), std::llabs(oy));
+					k = 4 * (ox * ox + oy * oy);
+				}
+				if (dist < best || (dist == best && k < key))
+				{
+					best = static_cast<int>(dist);
+					key = k;
 				}
 			}
-			break;
 		}
-		default:
-		{
-			break;
-		}
-		} //end of switch-case
-
-		y = min_i;
-		x = min_j;
-		return minDist;
-	} //end of the method calcBestMatchingUnit()
+		return best <= radius;
+	}
 
-	friend YAML::Emitter &operator<<(YAML::Emitter &out, const SOM<T> &som)
+	/// <summary>
+	/// floor(v / 2) for negative values as well.
+	/// </summary>
+	static int floorDiv2(int v)
 	{
-		out << YAML::BeginMap;
-		out << YAML::Key << "W";
-		out << YAML::Value << som.W;
-
-		out << YAML::Key << "H";
-		out << YAML::Value << som.H;
-
-		out << YAML::Key << "D";
-		out << YAML::Value << som.D;
-
-		out << YAML::Key << "DistanceType";
-		out << YAML::Value << static_cast<unsigned char>(som.distanceType);
-
-		out << YAML::Key << "BMDistType";
-		out << YAML::Value << static_cast<unsigned char>(som.bmdistType);
-
-		out << YAML::Key << "weights";
-		out << YAML::Value;
-		out << YAML::Flow << som.weights;
-		out << YAML::EndMap;
+		return v >= 0 ? v / 2 : -((-v + 1) / 2);
+	}
 
-		return out;
+	/// <summary>
+	/// neighborhood coefficient of a node at the given squared
+	/// lattice distance \f$ d^2 \f$ to the BMU, with r the current
+	/// neighborhood size: 1 for Uniform, \f$ e^{-d/r} \f$ for ExpDecay
+	/// and \f$ e^{-d^2/(2\sigma^2)}, \sigma = r/2 \f$ for Gaussian.
+	/// At r = 0 only the BMU itself gets a coefficient (of 1).
+	/// </summary>
+	/// <param name="dist2">squared lattice distance</param>
+	/// <param name="neighborhoodSize">neighborhood size</param>
+	/// <returns>update coefficient.</returns>
+	T neighborhoodCoef(double dist2, double neighborhoodSize) const
+	{
+		switch (bmdistType)
+		{
+		case BMDistType::ExpDecay:
+		{
+			if (neighborhoodSize <= 0.0)
+				return static_cast<T>(dist2 == 0.0 ? 1.0 : 0.0);
+			return static_cast<T>(exp(-sqrt(dist2) / neighborhoodSize));
+		}
+		case BMDistType::Gaussian:
+		{
+			const double sigma = neighborhoodSize / 2.0;
+			const double denom = 2.0 * sigma * sigma;
+			// the shrinking radius underflows to 0 at the end of training.
+			if (!(denom > 0.0))
+				return static_cast<T>(dist2 == 0.0 ? 1.0 : 0.0);
+			return static_cast<T>(exp(-dist2 / denom));
+		}
+		default:
+			return static_cast<T>(1.0);
+		}
 	}
-	friend void operator>>(const YAML::Node &node, SOM<T> &som)
+
+	/// <summary>
+	/// updates weights of the BMU and its neighborhood with a
+	/// streaming pass over the row runs of the neighborhood table.
+	/// Runs are clipped at the borders, or split in two where they
+	/// wrap around on toroidal lattices.
+	/// </summary>
+	/// <param name="table">neighborhood table</param>
+	/// <param name="y">row of the BMU</param>
+	/// <param name="x">column of the BMU</param>
+	/// <param name="sample">training sample</param>
+	/// <param name="learnRate">current learning rate</param>
+	/// <param name="neighborhoodSize">current neighborhood size</param>
+	void updateNeighborhood(const NeighborTable &table, int y, int x,
+							const std::vector<T> &sample, double learnRate,
+							double neighborhoodSize)
 	{
-		som.W = node["W"].as<int>();
-		som.H = node["H"].as<int>();
-		som.D = node["D"].as<int>();
-		som.distanceType = static_cast<DistanceType>(node["DistanceType"].as<unsigned char>());
-		som.bmdistType = static_cast<BMDistType>(node["BMDistType"].as<unsigned char>());
-		YAML::Node weights = node["weights"];
-		som.weights.resize(weights.size());
-#pragma omp parallel for
-		for (int i = 0; i < weights.size(); ++i)
+		neighborCoefs.resize(table.dist2.size());
+		for (size_t c = 0; c < table.dist2.size(); ++c)
 		{
-			som.weights[i] = weights[i].as<T>();
+			neighborCoefs[c] = static_cast<T>(learnRate * neighborhoodCoef(table.dist2[c], neighborhoodSize));
+		}
+		const bool toroidal = isToroidal(latticeTopology);
+		const int parity = isHexagonal(latticeTopology) ? (y & 1) : 0;
+		const int *classes = table.classes[parity].data();
+		for (const NeighborRun &run : table.runs[parity])
+		{
+			int row = y + run.dy;
+			int c0 = x + run.dxBegin;
+			int c1 = c0 + run.count - 1;
+			const int *cls = classes + run.classBegin;
+			if (toroidal)
+			{
+				row = row < 0 ? row + H : (row >= H ? row - H : row);
+				if (c0 < 0)
+				{
+					updateRun(row, c0 + W, W - 1, cls, sample);
+					cls += -c0;
+					c0 = 0;
+				}
+				else if (c1 >= W)
+				{
+					updateRun(row, c0, W - 1, cls, sample);
+					cls += W - c0;
+					c0 = 0;
+					c1 -= W;
+				}
+			}
+			else
+			{
+				if (row < 0 || row >= H)
+					continue;
+				if (c0 < 0)
+				{
+					cls += -c0;
+					c0 = 0;
+				}
+				c1 = std::min(c1, W - 1);
+			}
+			updateRun(row, c0, c1, cls, sample);
 		}
 	}
 
-  private:
 	/// <summary>
-	/// calculates Euclidean Distance between 2 vectors.
+	/// updates a contiguous run of nodes [c0, c1] in a row.
 	/// </summary>
-	/// <param name="v1">vector 1</param>
-	/// <param name="v2">vector 2</param>
-	/// <returns>euclidean distance</returns>
-	inline T euclideanDistance(const std::vector<T> &v1,
-							   const std::vector<T> &v2) const
+	inline void updateRun(int row, int c0, int c1, const int *cls,
+						  const std::vector<T> &sample)
 	{
-		T sum = static_cast<T>(0.0);
-		for (int i = 0; i < v1.size(); ++i)
+		if (c0 > c1)
+			return;
+		markDirty(row, c0, row, c1);
+		nodeUpdateCount += c1 - c0 + 1;
+		const T *s = sample.data();
+		T *wi = nodeAt(row, c0);
+		for (int n = 0; n <= c1 - c0; ++n, wi += D)
 		{
-			sum += (v1[i] - v2[i]) * (v1[i] - v2[i]);
+			const T rate = neighborCoefs[cls[n]];
+			for (int k = 0; k < D; ++k)
+			{
+				wi[k] += (s[k] - wi[k]) * rate;
+			}
 		}
-		return sqrt(sum);
 	}
+
 	/// <summary>
-	/// calculates squared euclidean distance between 2 vectors.
+	/// calculates the U-matrix value of a node, i.e. average
+	/// euclidean distance to its lattice neighbors.
 	/// </summary>
-	/// <param name="v1">vector 1</param>
-	/// <param name="v2">vector 2</param>
-	/// <returns>euclidean distance</returns>
-	inline T squaredEuclideanDistance(const std::vector<T> &v1,
-									  const std::vector<T> &v2) const
+	/// <param name="i">row of the node</param>
+	/// <param name="j">column of the node</param>
+	/// <param name="topology">lattice topology</param>
+	/// <returns>average distance to neighbors.</returns>
+	T uMatrixValue(int i, int j, LatticeTopology topology) const
 	{
+		static const int rectOffsets[4][2] = {{-1, 0}, {0, -1}, {0, 1}, {1, 0}};
+		// (row, col) offsets for even and odd rows of a hexagonal lattice.
+		static const int hexEvenOffsets[6][2] = {{-1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, -1}, {1, 0}};
+		static const int hexOddOffsets[6][2] = {{-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, 0}, {1, 1}};
+
+		const int(*offsets)[2] = rectOffsets;
+		int nOffsets = 4;
+		if (isHexagonal(topology))
+		{
+			offsets = (i % 2 == 0) ? hexEvenOffsets : hexOddOffsets;
+			nOffsets = 6;
+		}
+		const bool toroidal = isToroidal(topology);
+
+		const T *node = nodeAt(i, j);
 		T sum = static_cast<T>(0.0);
-		for (int i = 0; i < v1.size(); ++i)
+		int count = 0;
+		for (int n = 0; n < nOffsets; ++n)
 		{
-			sum += (v1[i] - v2[i]) * (v1[i] - v2[i]);
+			int ni = i + offsets[n][0];
+			int nj = j + offsets[n][1];
+			if (toroidal)
+			{
+				ni = (ni + H) % H;
+				nj = (nj + W) % W;
+			}
+			else if (ni < 0 || ni >= H || nj < 0 || nj >= W)
+				continue;
+			const T *neighbor = nodeAt(ni, nj);
+			T dist = static_cast<T>(0.0);
+			for (int k = 0; k < D; ++k)
+			{
+				dist += (node[k] - neighbor[k]) * (node[k] - neighbor[k]);
+			}
+			sum += sqrt(dist);
+			++count;
 		}
-		return sum;
+		return count ? sum / count : static_cast<T>(0.0);
 	}
 	/// <summary>
 	/// calculates Gaussian function of given x.
@@ -869,4 +2905,173 @@ class SOM
 	/// weights / nodes of SOM
 	/// </summary>
 	std::vector<T> weights;
+
+	/// <summary>
+	/// block size (in coordinates) of partial distance checks.
+	/// </summary>
+	static const int PDS_BLOCK = 8;
+
+	/// <summary>
+	/// #N of nodes scanned per block in @calcBestMatchingUnits().
+	/// </summary>
+	static const int BATCH_NODE_BLOCK = 256;
+
+	/// <summary>
+	/// whether the pruned BMU search is used,
+	/// see @enableBMUPruning()
+	/// </summary>
+	bool bmuPruning = false;
+
+	/// <summary>
+	/// requested #N of pivot nodes.
+	/// </summary>
+	int numPivots = 0;
+
+	/// <summary>
+	/// whether @pivotDistances matches current weights.
+	/// </summary>
+	bool pivotBoundsValid = false;
+
+#ifndef NDEBUG
+	/// <summary>
+	/// @weightsChecksum() when the pivot bounds were last updated,
+	/// debug builds use it to detect writes through @nodeAt().
+	/// </summary>
+	uint64_t pivotWeightsChecksum = 0;
+#endif
+
+	/// <summary>
+	/// node indices (i * W + j) of pivot nodes.
+	/// </summary>
+	std::vector<int> pivotIndices;
+
+	/// <summary>
+	/// distances between nodes and pivots, (W*H) x #N of pivots.
+	/// </summary>
+	std::vector<T> pivotDistances;
+
+	/// <summary>
+	/// pruning counters of @train(), see @pruningStats()
+	/// </summary>
+	BMUPruningStats pruneStats;
+
+	/// <summary>
+	/// checkpoint file path used by @train(), see @setCheckpointing()
+	/// </summary>
+	std::string checkpointPath;
+
+	/// <summary>
+	/// checkpoint interval in iterations, 0 means disabled.
+	/// </summary>
+	unsigned int checkpointEvery = 0;
+
+	/// <summary>
+	/// #N of node updates done by @train(), see @nodeUpdates()
+	/// </summary>
+	unsigned long long nodeUpdateCount = 0;
+
+	/// <summary>
+	/// lattice topology used by @train(), see @setTopology()
+	/// </summary>
+	LatticeTopology latticeTopology = LatticeTopology::Rectangular;
+
+	/// <summary>
+	/// max #N of cached neighborhood tables.
+	/// </summary>
+	static const size_t NEIGHBOR_TABLE_CACHE = 64;
+
+	/// <summary>
+	/// neighborhood tables by radius, see @neighborTable()
+	/// </summary>
+	std::map<int, NeighborTable> neighborTables;
+
+	/// <summary>
+	/// per distance class coefficients times learning rate
+	/// of the current iteration.
+	/// </summary>
+	std::vector<T> neighborCoefs;
+
+	/// <summary>
+	/// magic header of checkpoint files.
+	/// </summary>
+	static constexpr char CHECKPOINT_MAGIC[8] = {'S', 'O', 'M', 'C', 'K', 'P', 'T', '1'};
+
+	/// <summary>
+	/// cached U-matrix, see @uMatrix()
+	/// </summary>
+	std::vector<T> uMatrixCache;
+
+	/// <summary>
+	/// topology of the cached U-matrix.
+	/// </summary>
+	LatticeTopology uMatrixTopology = LatticeTopology::Rectangular;
+
+	/// <summary>
+	/// whether @uMatrixCache is usable apart from dirty regions.
+	/// </summary>
+	bool uMatrixValid = false;
+
+	/// <summary>
+	/// per row, first and last modified columns since
+	/// the last U-matrix refresh (empty if min > max).
+	/// </summary>
+	std::vector<int> dirtyMinCol, dirtyMaxCol;
+
+#if ENABLE_ROCKSDB
+	/// <summary>
+	/// max tile size (in nodes, per side) of the RocksDB layout.
+	/// </summary>
+	static const int ROCKSDB_MAX_TILE = 32;
+
+	/// <summary>
+	/// max size of a tile (RocksDB value) in bytes,
+	/// tiles of long weight vectors get fewer nodes.
+	/// </summary>
+	static const size_t ROCKSDB_TILE_BYTES = 256 * 1024;
+
+	/// <summary>
+	/// size in bytes at which a RocksDB write batch is flushed.
+	/// </summary>
+	static const size_t ROCKSDB_BATCH_BYTES = 4 * 1024 * 1024;
+
+	/// <summary>
+	/// tile size of the opened/saved DB layout, 0 if there is none,
+	/// see @tileSide().
+	/// </summary>
+	int rocksDBTileSide = 0;
+
+	/// <summary>
+	/// DB opened by @openLazy(), tiles are read from it on demand.
+	/// </summary>
+	std::shared_ptr<rocksdb::DB> rocksDB;
+
+	/// <summary>
+	/// path of @rocksDB
+	/// </summary>
+	std::string rocksDBPath;
+
+	/// <summary>
+	/// whether the DB at @rocksDBSyncedPath holds all tiles
+	/// except the ones marked in @tileDirty.
+	/// </summary>
+	bool rocksDBSynced = false;
+
+	/// <summary>
+	/// path of the last saved/loaded DB.
+	/// </summary>
+	std::string rocksDBSyncedPath;
+
+	/// <summary>
+	/// per tile, whether it is resident (empty if all are).
+	/// </summary>
+	std::vector<unsigned char> tileLoaded;
+
+	/// <summary>
+	/// per tile, whether it was modified since the last save/load.
+	/// </summary>
+	std::vector<unsigned char> tileDirty;
+#endif
 };
+
+template <class T>
+constexpr char SOM<T>::CHECKPOINT_MAGIC[8];
@@ -0,0 +1,482 @@
+/*************************************************************************
+* Self Organizing Maps implementation
+*************************************************************************
+** @file    SOMNuma.h
+** @date    18.10.2026
+** @author  Yasin Yıldırım <yildirimyasi(at)gmail(dot)com>
+** @copyright Copyright (c) 2018-present, Yasin Yıldırım
+** @license See attached LICENSE.txt
+************************************************************************/
+
+//document this file.
+/*! \file */
+
+#pragma once
+#include "SOM.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/// <summary>
+/// Result of @SOMNumaShards::benchmark().
+/// </summary>
+struct SOMNumaBenchmark
+{
+	/// <summary>
+	/// #N of shards (NUMA nodes) used.
+	/// </summary>
+	int shards = 1;
+	/// <summary>
+	/// BMU searches per second of the sharded scan.
+	/// </summary>
+	double shardedQPS = 0.0;
+	/// <summary>
+	/// BMU searches per second of the default scan, i.e. OpenMP
+	/// threads sharing the single weights vector of the SOM.
+	/// </summary>
+	double defaultQPS = 0.0;
+};
+
+/// <summary>
+/// NUMA-aware sharded copy of a SOM codebook for parallel BMU search.
+/// Lattice rows are partitioned into one shard per NUMA node, in
+/// proportion to the node's CPU count. Each shard is allocated and
+/// first-touched by worker threads pinned to the CPUs of its node,
+/// so its pages are local to them. A search is scanned by all workers
+/// on their own rows and the candidates are reduced.
+/// NUMA nodes are read from /sys/devices/system/node; on non-NUMA
+/// machines (or other platforms) a single unpinned shard is used.
+/// The shards are a snapshot, rebuild them after the SOM is trained.
+/// </summary>
+template <class T>
+class SOMNumaShards
+{
+  public:
+	/// <summary>
+	/// Constructor, partitions the codebook and starts the workers.
+	/// </summary>
+	/// <param name="som">trained SOM</param>
+	/// <param name="threadsPerShard">#N of worker threads per shard,
+	///  0 means one per CPU of the NUMA node.</param>
+	SOMNumaShards(const SOM<T> &som, int threadsPerShard = 0)
+		: som(som), W(som.cols()), H(som.rows()), D(som.dims()),
+		  distanceType(som.distanceMetric())
+	{
+#if ENABLE_ROCKSDB
+		if (!som.isRegionLoaded(0, 0, H - 1, W - 1))
+		{
+			throw std::logic_error("SOM is partially loaded, call loadRegion() first");
+		}
+#endif
+		std::vector<std::vector<int>> nodes = numaNodeCpus();
+		int totalCpus = 0;
+		for (const std::vector<int> &cpus : nodes)
+			totalCpus += static_cast<int>(cpus.size());
+
+		// rows per shard are proportional to the CPUs of its node.
+		int row = 0, cpusSoFar = 0;
+		for (size_t n = 0; n < nodes.size() && row < H; ++n)
+		{
+			cpusSoFar += static_cast<int>(nodes[n].size());
+			int rowEnd = (n + 1 == nodes.size()) ? H
+												 : static_cast<int>(static_cast<long long>(H) * cpusSoFar / totalCpus);
+			if (rowEnd <= row)
+				continue;
+			Shard shard;
+			shard.cpus = nodes[n];
+			shard.cpuCount = static_cast<int>(nodes[n].size());
+			shard.rowBegin = row;
+			shard.rowEnd = rowEnd;
+			shards.push_back(std::move(shard));
+			row = rowEnd;
+		}
+		if (shards.size() == 1 && nodes.size() == 1)
+		{
+			// not NUMA, don't restrict the scheduler.
+			shards[0].cpus.clear();
+		}
+
+		for (size_t s = 0; s < shards.size(); ++s)
+		{
+			Shard &shard = shards[s];
+			int nThreads = threadsPerShard > 0 ? threadsPerShard : std::max(1, shard.cpuCount);
+			nThreads = std::min(nThreads, shard.rowEnd - shard.rowBegin);
+			shard.data.resize(nThreads);
+			for (int t = 0; t < nThreads; ++t)
+			{
+				Worker worker;
+				worker.shard = static_cast<int>(s);
+				worker.slot = t;
+				worker.rowBegin = shard.rowBegin + (shard.rowEnd - shard.rowBegin) * t / nThreads;
+				worker.rowEnd = shard.rowBegin + (shard.rowEnd - shard.rowBegin) * (t + 1) / nThreads;
+				workers.push_back(worker);
+			}
+		}
+
+		results.resize(workers.size());
+		pending = static_cast<int>(workers.size());
+		for (size_t w = 0; w < workers.size(); ++w)
+		{
+			threads.emplace_back(&SOMNumaShards::work, this, static_cast<int>(w));
+		}
+		// wait until every worker has first-touched its rows.
+		std::unique_lock<std::mutex> lock(mtx);
+		doneCv.wait(lock, [this] { return pending == 0; });
+	}
+
+	SOMNumaShards(const SOMNumaShards &) = delete;
+	SOMNumaShards &operator=(const SOMNumaShards &) = delete;
+
+	/// <summary>
+	/// Destructor, joins the workers.
+	/// </summary>
+	virtual ~SOMNumaShards()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		jobCv.notify_all();
+		for (std::thread &t : threads)
+			t.join();
+	}
+
+	/// <summary>
+	/// get #N of shards.
+	/// </summary>
+	/// <returns></returns>
+	int shardCount() const { return static_cast<int>(shards.size()); }
+
+	/// <summary>
+	/// calculates Best Matching Unit, see @SOM::calcBestMatchingUnit().
+	/// </summary>
+	/// <param name="sample">input sample</param>
+	/// <param name="y">row of the winning neuron</param>
+	/// <param name="x">column of the winning neuron</param>
+	/// <returns> distance between BMU and sample </returns>
+	T calcBestMatchingUnit(const std::vector<T> &sample, int &y, int &x)
+	{
+		std::vector<const std::vector<T> *> samples(1, &sample);
+		std::vector<int> ys, xs;
+		std::vector<T> dists;
+		calcBestMatchingUnits(samples, ys, xs, dists);
+		y = ys[0];
+		x = xs[0];
+		return dists[0];
+	}
+
+	/// <summary>
+	/// calculates Best Matching Units of a batch of samples.
+	/// All workers scan their rows for the whole batch, then the
+	/// candidates are reduced (ties resolve to the lowest node index).
+	/// </summary>
+	/// <param name="samples">input samples</param>
+	/// <param name="ys">rows of the winning neurons</param>
+	/// <param name="xs">columns of the winning neurons</param>
+	/// <param name="dists">distances between BMUs and samples</param>
+	void calcBestMatchingUnits(const std::vector<const std::vector<T> *> &samples,
+							   std::vector<int> &ys, std::vector<int> &xs,
+							   std::vector<T> &dists)
+	{
+		for (const std::vector<T> *sample : samples)
+		{
+			if (sample->size() != static_cast<size_t>(D))
+			{
+				throw std::runtime_error("input sample has different size than SOM");
+			}
+		}
+		// one search at a time, workers are shared.
+		std::lock_guard<std::mutex> searchLock(searchMtx);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			job = &samples;
+			pending = static_cast<int>(workers.size());
+			++generation;
+		}
+		jobCv.notify_all();
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			doneCv.wait(lock, [this] { return pending == 0; });
+			job = nullptr;
+		}
+
+		const size_t n = samples.size();
+		ys.assign(n, 0);
+		xs.assign(n, 0);
+		dists.assign(n, std::numeric_limits<T>::max());
+		std::vector<int> best(n, 0);
+		// workers are ordered by rows, so strict comparison keeps
+		// the lowest index on ties.
+		for (const Result &res : results)
+		{
+			for (size_t s = 0; s < n; ++s)
+			{
+				if (res.dist[s] < dists[s])
+				{
+					dists[s] = res.dist[s];
+					best[s] = res.node[s];
+				}
+			}
+		}
+		for (size_t s = 0; s < n; ++s)
+		{
+			ys[s] = best[s] / W;
+			xs[s] = best[s] % W;
+			if (distanceType == DistanceType::Euclidean)
+				dists[s] = sqrt(dists[s]);
+		}
+	}
+
+	/// <summary>
+	/// measures BMU search throughput of the sharded scan and of the
+	/// default scan (OpenMP over samples, single weights vector).
+	/// </summary>
+	/// <param name="samples">samples to search</param>
+	/// <param name="batch">#N of samples per sharded search</param>
+	/// <returns>throughput of both scans.</returns>
+	SOMNumaBenchmark benchmark(const std::vector<std::vector<T>> &samples, size_t batch = 64)
+	{
+		typedef std::chrono::steady_clock Clock;
+		SOMNumaBenchmark result;
+		result.shards = shardCount();
+
+		std::vector<int> ys, xs;
+		std::vector<T> dists;
+		Clock::time_point t0 = Clock::now();
+		for (size_t b = 0; b < samples.size(); b += batch)
+		{
+			std::vector<const std::vector<T> *> chunk;
+			for (size_t s = b; s < std::min(samples.size(), b + batch); ++s)
+				chunk.push_back(&samples[s]);
+			calcBestMatchingUnits(chunk, ys, xs, dists);
+		}
+		result.shardedQPS = samples.size() /
+							std::chrono::duration<double>(Clock::now() - t0).count();
+
+		t0 = Clock::now();
+		const int N = static_cast<int>(samples.size());
+#pragma omp parallel
+		{
+			BMUPruningStats stats;
+#pragma omp for schedule(static)
+			for (int s = 0; s < N; ++s)
+			{
+				int y, x;
+				som.calcBestMatchingUnit(samples[s], y, x, stats);
+			}
+		}
+		result.defaultQPS = samples.size() /
+							std::chrono::duration<double>(Clock::now() - t0).count();
+		return result;
+	}
+
+  private:
+	/// <summary>
+	/// rows of a NUMA node, stored per worker.
+	/// </summary>
+	struct Shard
+	{
+		std::vector<int> cpus;
+		int cpuCount = 0;
+		int rowBegin = 0, rowEnd = 0;
+		std::vector<std::vector<T>> data;
+	};
+
+	/// <summary>
+	/// rows scanned by a worker thread.
+	/// </summary>
+	struct Worker
+	{
+		int shard = 0, slot = 0;
+		int rowBegin = 0, rowEnd = 0;
+	};
+
+	/// <summary>
+	/// best candidate of a worker per sample.
+	/// </summary>
+	struct Result
+	{
+		std::vector<T> dist;
+		std::vector<int> node;
+	};
+
+	/// <summary>
+	/// reads CPU lists of online NUMA nodes,
+	/// a single node with all CPUs if unavailable.
+	/// </summary>
+	static std::vector<std::vector<int>> numaNodeCpus()
+	{
+		std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+		for (int n = 0;; ++n)
+		{
+			std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+			if (!in)
+				break;
+			std::string list;
+			std::getline(in, list);
+			std::vector<int> cpus;
+			std::stringstream ss(list);
+			std::string range;
+			while (std::getline(ss, range, ','))
+			{
+				if (range.empty())
+					continue;
+				size_t dash = range.find('-');
+				int first = std::stoi(range.substr(0, dash));
+				int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+				for (int c = first; c <= last; ++c)
+					cpus.push_back(c);
+			}
+			// memory-only nodes have no CPUs.
+			if (!cpus.empty())
+				nodes.push_back(cpus);
+		}
+#endif
+		if (nodes.empty())
+		{
+			nodes.push_back(std::vector<int>(std::max(1u, std::thread::hardware_concurrency())));
+		}
+		return nodes;
+	}
+
+	/// <summary>
+	/// pins the calling thread to the given CPUs.
+	/// </summary>
+	static void pin(const std::vector<int> &cpus)
+	{
+#if defined(__linux__)
+		if (cpus.empty())
+			return;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int c : cpus)
+			CPU_SET(c, &set);
+		sched_setaffinity(0, sizeof(set), &set);
+#endif
+	}
+
+	/// <summary>
+	/// worker loop. The worker pins itself, allocates and copies
+	/// its rows (first touch), then scans them for each job.
+	/// </summary>
+	void work(int w)
+	{
+		const Worker &worker = workers[w];
+		Shard &shard = shards[worker.shard];
+		pin(shard.cpus);
+
+		std::vector<T> &rows = shard.data[worker.slot];
+		rows.assign(static_cast<size_t>(worker.rowEnd - worker.rowBegin) * W * D,
+					static_cast<T>(0.0));
+		if (!rows.empty())
+		{
+			std::memcpy(rows.data(), som.nodeAt(worker.rowBegin, 0), rows.size() * sizeof(T));
+		}
+
+		unsigned long long seen = 0;
+		for (;;)
+		{
+			const std::vector<const std::vector<T> *> *samples;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				if (--pending == 0)
+					doneCv.notify_all();
+				jobCv.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+				samples = job;
+			}
+			scan(worker, rows, *samples, results[w]);
+		}
+	}
+
+	/// <summary>
+	/// finds the best candidate of each sample in the worker's rows.
+	/// </summary>
+	void scan(const Worker &worker, const std::vector<T> &rows,
+			  const std::vector<const std::vector<T> *> &samples, Result &res) const
+	{
+		const size_t n = samples.size();
+		res.dist.assign(n, std::numeric_limits<T>::max());
+		res.node.assign(n, 0);
+		const int nodes = (worker.rowEnd - worker.rowBegin) * W;
+		const int first = worker.rowBegin * W;
+		for (size_t s = 0; s < n; ++s)
+		{
+			const T *sv = samples[s]->data();
+			for (int node = 0; node < nodes; ++node)
+			{
+				const T dist = distance(sv, &rows[static_cast<size_t>(node) * D]);
+				if (dist < res.dist[s])
+				{
+					res.dist[s] = dist;
+					res.node[s] = first + node;
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// distance used for comparisons, squared for the euclidean
+	/// metrics and 1/(1+similarity) for the similarity metrics.
+	/// </summary>
+	T distance(const T *v1, const T *v2) const
+	{
+		T sum = static_cast<T>(0.0);
+		switch (distanceType)
+		{
+		case DistanceType::DotProduct:
+		{
+			for (int k = 0; k < D; ++k)
+				sum += v1[k] * v2[k];
+			return static_cast<T>(1.0 / (1.0 + sum));
+		}
+		case DistanceType::CosineSimiarity:
+		{
+			T n1 = static_cast<T>(0.0), n2 = static_cast<T>(0.0);
+			for (int k = 0; k < D; ++k)
+			{
+				sum += v1[k] * v2[k];
+				n1 += v1[k] * v1[k];
+				n2 += v2[k] * v2[k];
+			}
+			return static_cast<T>(1.0 / (1.0 + sum / sqrt(n1 * n2)));
+		}
+		default:
+		{
+			for (int k = 0; k < D; ++k)
+				sum += (v1[k] - v2[k]) * (v1[k] - v2[k]);
+			return sum;
+		}
+		}
+	}
+
+	/// <summary>
+	/// source SOM, used for the initial copy and the benchmark.
+	/// </summary>
+	const SOM<T> &som;
+	const int W, H, D;
+	const DistanceType distanceType;
+
+	std::vector<Shard> shards;
+	std::vector<Worker> workers;
+	std::vector<Result> results;
+	std::vector<std::thread> threads;
+
+	std::mutex searchMtx;
+	std::mutex mtx;
+	std::condition_variable jobCv, doneCv;
+	const std::vector<const std::vector<T> *> *job = nullptr;
+	unsigned long long generation = 0;
+	int pending = 0;
+	bool stopping = false;
+};
@@ -0,0 +1,360 @@
+/*************************************************************************
+* Self Organizing Maps implementation
+*************************************************************************
+** @file    SOMProfiler.h
+** @date    18.10.2026
+** @author  Yasin Yıldırım <yildirimyasi(at)gmail(dot)com>
+** @copyright Copyright (c) 2018-present, Yasin Yıldırım
+** @license See attached LICENSE.txt
+************************************************************************/
+
+//document this file.
+/*! \file */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#define SOM_PROFILER_PERF 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Aggregated measurements of a profiled phase.
+/// Hardware counters are 0 if they are unavailable.
+/// </summary>
+struct SOMPhaseSummary
+{
+	/// <summary>
+	/// #N of spans.
+	/// </summary>
+	unsigned long long count = 0;
+	/// <summary>
+	/// total wall time in microseconds.
+	/// </summary>
+	double totalUs = 0.0;
+	/// <summary>
+	/// total CPU cycles.
+	/// </summary>
+	unsigned long long cycles = 0;
+	/// <summary>
+	/// total retired instructions.
+	/// </summary>
+	unsigned long long instructions = 0;
+	/// <summary>
+	/// total last level cache misses.
+	/// </summary>
+	unsigned long long llcMisses = 0;
+};
+
+/// <summary>
+/// Collects trace spans of SOM phases (BMU search, neighborhood
+/// update, save, load, ...) and, on Linux when perf_event_open is
+/// permitted, per-thread hardware counters (cycles, instructions,
+/// LLC misses) for each span. Spans are written as Chrome trace-event
+/// JSON (chrome://tracing, Perfetto) by @writeTrace().
+/// Only used when SOM.h is compiled with ENABLE_SOM_PROFILING.
+/// </summary>
+class SOMProfiler
+{
+  public:
+	typedef std::chrono::steady_clock Clock;
+
+	/// <summary>
+	/// get the process wide profiler.
+	/// </summary>
+	static SOMProfiler &instance()
+	{
+		static SOMProfiler profiler;
+		return profiler;
+	}
+
+	/// <summary>
+	/// sets the max #N of spans kept for the trace. Spans beyond
+	/// the limit are only aggregated, see @summary().
+	/// </summary>
+	/// <param name="n">max #N of spans</param>
+	void setMaxEvents(size_t n) { maxEvents = n; }
+
+	/// <summary>
+	/// whether hardware counters could be opened (on the calling thread).
+	/// </summary>
+	bool countersAvailable() { return thread().perfFd >= 0; }
+
+	/// <summary>
+	/// drops all recorded spans and summaries.
+	/// </summary>
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (std::shared_ptr<Buffer> &buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mtx);
+			buffer->events.clear();
+			buffer->phases.clear();
+		}
+		storedEvents = 0;
+	}
+
+	/// <summary>
+	/// aggregates spans of all threads per phase name.
+	/// </summary>
+	/// <returns>summary per phase.</returns>
+	std::map<std::string, SOMPhaseSummary> summary()
+	{
+		std::map<std::string, SOMPhaseSummary> result;
+		std::lock_guard<std::mutex> lock(mtx);
+		for (std::shared_ptr<Buffer> &buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mtx);
+			for (const std::pair<const char *const, SOMPhaseSummary> &phase : buffer->phases)
+			{
+				SOMPhaseSummary &sum = result[phase.first];
+				sum.count += phase.second.count;
+				sum.totalUs += phase.second.totalUs;
+				sum.cycles += phase.second.cycles;
+				sum.instructions += phase.second.instructions;
+				sum.llcMisses += phase.second.llcMisses;
+			}
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// writes the recorded spans as Chrome trace-event JSON.
+	/// </summary>
+	/// <param name="path">output file path</param>
+	void writeTrace(const std::string &path)
+	{
+		std::ofstream out(path);
+		if (!out)
+		{
+			throw std::runtime_error("cannot write trace: " + path);
+		}
+		out << "{\"traceEvents\":[";
+		bool first = true;
+		std::lock_guard<std::mutex> lock(mtx);
+		for (std::shared_ptr<Buffer> &buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mtx);
+			for (const Event &e : buffer->events)
+			{
+				out << (first ? "" : ",") << "\n{\"name\":\"" << e.name
+					<< "\",\"cat\":\"som\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+					<< ",\"ts\":" << e.startUs << ",\"dur\":" << e.durationUs;
+				if (e.hasCounters)
+				{
+					out << ",\"args\":{\"cycles\":" << e.counters[0]
+						<< ",\"instructions\":" << e.counters[1]
+						<< ",\"llc_misses\":" << e.counters[2] << "}";
+				}
+				out << "}";
+				first = false;
+			}
+		}
+		out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	}
+
+  private:
+	/// <summary>
+	/// a finished span.
+	/// </summary>
+	struct Event
+	{
+		const char *name;
+		double startUs;
+		double durationUs;
+		bool hasCounters;
+		uint64_t counters[3];
+	};
+
+	/// <summary>
+	/// spans of a thread, kept after the thread exits.
+	/// </summary>
+	struct Buffer
+	{
+		std::mutex mtx;
+		int tid = 0;
+		std::vector<Event> events;
+		std::map<const char *, SOMPhaseSummary> phases;
+	};
+
+	/// <summary>
+	/// per-thread perf counter group and span buffer.
+	/// </summary>
+	struct ThreadState
+	{
+		std::shared_ptr<Buffer> buffer;
+		int perfFd = -1;
+		int memberFds[2] = {-1, -1};
+
+		ThreadState()
+		{
+#if SOM_PROFILER_PERF
+			const uint64_t configs[3] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+										 PERF_COUNT_HW_CACHE_MISSES};
+			for (int c = 0; c < 3; ++c)
+			{
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = configs[c];
+				attr.read_format = PERF_FORMAT_GROUP;
+				attr.disabled = (c == 0);
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1,
+												  c == 0 ? -1 : perfFd, 0));
+				if (fd < 0)
+				{
+					closeCounters();
+					return;
+				}
+				if (c == 0)
+					perfFd = fd;
+				else
+					memberFds[c - 1] = fd;
+			}
+			ioctl(perfFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+		}
+
+		~ThreadState()
+		{
+			closeCounters();
+		}
+
+		void closeCounters()
+		{
+#if SOM_PROFILER_PERF
+			for (int &fd : memberFds)
+			{
+				if (fd >= 0)
+					close(fd);
+				fd = -1;
+			}
+			if (perfFd >= 0)
+				close(perfFd);
+			perfFd = -1;
+#endif
+		}
+
+		/// <summary>
+		/// reads cycles, instructions and LLC misses of the thread.
+		/// </summary>
+		bool readCounters(uint64_t values[3])
+		{
+#if SOM_PROFILER_PERF
+			if (perfFd < 0)
+				return false;
+			// PERF_FORMAT_GROUP: nr, then one value per counter.
+			uint64_t data[4];
+			if (read(perfFd, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[0] != 3)
+				return false;
+			values[0] = data[1];
+			values[1] = data[2];
+			values[2] = data[3];
+			return true;
+#else
+			(void)values;
+			return false;
+#endif
+		}
+	};
+
+	SOMProfiler() : origin(Clock::now()) {}
+
+	/// <summary>
+	/// state of the calling thread, created and registered on first use.
+	/// </summary>
+	ThreadState &thread()
+	{
+		thread_local ThreadState state;
+		if (!state.buffer)
+		{
+			state.buffer = std::make_shared<Buffer>();
+			std::lock_guard<std::mutex> lock(mtx);
+			state.buffer->tid = static_cast<int>(buffers.size()) + 1;
+			buffers.push_back(state.buffer);
+		}
+		return state;
+	}
+
+	void record(ThreadState &state, const Event &e)
+	{
+		Buffer &buffer = *state.buffer;
+		std::lock_guard<std::mutex> lock(buffer.mtx);
+		SOMPhaseSummary &phase = buffer.phases[e.name];
+		++phase.count;
+		phase.totalUs += e.durationUs;
+		phase.cycles += e.counters[0];
+		phase.instructions += e.counters[1];
+		phase.llcMisses += e.counters[2];
+		if (storedEvents.fetch_add(1, std::memory_order_relaxed) < maxEvents)
+		{
+			buffer.events.push_back(e);
+		}
+	}
+
+	const Clock::time_point origin;
+	std::mutex mtx;
+	std::vector<std::shared_ptr<Buffer>> buffers;
+	std::atomic<size_t> storedEvents{0};
+	size_t maxEvents = 1000000;
+
+  public:
+	/// <summary>
+	/// Scoped span, measures from construction to destruction.
+	/// </summary>
+	class Span
+	{
+	  public:
+		/// <summary>
+		/// starts a span.
+		/// </summary>
+		/// <param name="name">phase name, must be a string literal.</param>
+		explicit Span(const char *name) : name(name), state(SOMProfiler::instance().thread())
+		{
+			hasCounters = state.readCounters(startCounters);
+			start = Clock::now();
+		}
+
+		~Span()
+		{
+			const Clock::time_point end = Clock::now();
+			uint64_t endCounters[3];
+			Event e;
+			e.name = name;
+			e.hasCounters = hasCounters && state.readCounters(endCounters);
+			for (int c = 0; c < 3; ++c)
+				e.counters[c] = e.hasCounters ? endCounters[c] - startCounters[c] : 0;
+			e.startUs = std::chrono::duration<double, std::micro>(start - SOMProfiler::instance().origin).count();
+			e.durationUs = std::chrono::duration<double, std::micro>(end - start).count();
+			SOMProfiler::instance().record(state, e);
+		}
+
+		Span(const Span &) = delete;
+		Span &operator=(const Span &) = delete;
+
+	  private:
+		const char *name;
+		ThreadState &state;
+		Clock::time_point start;
+		uint64_t startCounters[3];
+		bool hasCounters;
+	};
+};
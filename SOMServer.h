@@ -0,0 +1,561 @@
+/*************************************************************************
+* Self Organizing Maps implementation
+*************************************************************************
+** @file    SOMServer.h
+** @date    18.10.2026
+** @author  Yasin Yıldırım <yildirimyasi(at)gmail(dot)com>
+** @copyright Copyright (c) 2018-present, Yasin Yıldırım
+** @license See attached LICENSE.txt
+************************************************************************/
+
+//document this file.
+/*! \file */
+
+#pragma once
+#include "SOM.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <system_error>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SOM_SERVER_UNIX_SOCKET 1
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Result of an inference request.
+/// </summary>
+template <class T>
+struct SOMInferenceResult
+{
+	/// <summary>
+	/// row of the BMU.
+	/// </summary>
+	int y = 0;
+	/// <summary>
+	/// column of the BMU.
+	/// </summary>
+	int x = 0;
+	/// <summary>
+	/// distance between BMU and sample.
+	/// </summary>
+	T distance = static_cast<T>(0.0);
+	/// <summary>
+	/// weight vector of the BMU, empty unless requested.
+	/// </summary>
+	std::vector<T> weights;
+};
+
+/// <summary>
+/// A point of the load benchmark, see
+/// @SOMInferenceServer::benchmark().
+/// </summary>
+struct SOMLoadPoint
+{
+	/// <summary>
+	/// offered load (requests/s over all clients), 0 means closed loop.
+	/// </summary>
+	double offeredQPS = 0.0;
+	/// <summary>
+	/// achieved throughput (requests/s).
+	/// </summary>
+	double throughput = 0.0;
+	/// <summary>
+	/// median latency in microseconds.
+	/// </summary>
+	double p50 = 0.0;
+	/// <summary>
+	/// 99th percentile latency in microseconds.
+	/// </summary>
+	double p99 = 0.0;
+	/// <summary>
+	/// mean #N of samples per executed batch.
+	/// </summary>
+	double meanBatch = 0.0;
+};
+
+/// <summary>
+/// Micro-batching local inference server for a trained SOM.
+/// Requests are queued in-process (@submit()) or received over
+/// a Unix domain socket (@listen()). Worker threads coalesce queued
+/// requests into batches of up to maxBatch samples, waiting at most
+/// the deadline after the oldest queued request, and run
+/// @SOM::calcBestMatchingUnits() on each batch.
+/// The SOM must outlive the server and must not be modified while
+/// the server is running.
+/// </summary>
+template <class T>
+class SOMInferenceServer
+{
+  public:
+	/// <summary>
+	/// Constructor, starts the worker pool.
+	/// </summary>
+	/// <param name="som">trained SOM</param>
+	/// <param name="workers">#N of worker threads</param>
+	/// <param name="maxBatch">max #N of samples per batch</param>
+	/// <param name="deadline">max time a request waits for its batch to fill</param>
+	SOMInferenceServer(const SOM<T> &som, int workers = 2, size_t maxBatch = 64,
+					   std::chrono::microseconds deadline = std::chrono::microseconds(200))
+		: som(som), maxBatch(std::max<size_t>(1, maxBatch)), deadline(deadline)
+	{
+		for (int i = 0; i < std::max(1, workers); ++i)
+		{
+			pool.emplace_back(&SOMInferenceServer::work, this);
+		}
+	}
+
+	SOMInferenceServer(const SOMInferenceServer &) = delete;
+	SOMInferenceServer &operator=(const SOMInferenceServer &) = delete;
+
+	/// <summary>
+	/// Destructor, stops the server.
+	/// </summary>
+	virtual ~SOMInferenceServer()
+	{
+		stop();
+	}
+
+	/// <summary>
+	/// queues an inference request.
+	/// </summary>
+	/// <param name="sample">input sample</param>
+	/// <param name="withWeights">return the BMU weight vector as well.</param>
+	/// <returns>future of the result.</returns>
+	std::future<SOMInferenceResult<T>> submit(std::vector<T> sample, bool withWeights = false)
+	{
+		// checked here, a bad sample must not fail the batch it would join.
+		if (sample.size() != static_cast<size_t>(som.dims()))
+		{
+			throw std::runtime_error("input sample has different size than SOM");
+		}
+		Request req;
+		req.sample = std::move(sample);
+		req.withWeights = withWeights;
+		req.enqueued = Clock::now();
+		std::future<SOMInferenceResult<T>> result = req.promise.get_future();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (stopping)
+			{
+				throw std::runtime_error("inference server is stopped");
+			}
+			queue.push_back(std::move(req));
+		}
+		cv.notify_one();
+		return result;
+	}
+
+#if SOM_SERVER_UNIX_SOCKET
+	/// <summary>
+	/// starts accepting requests on a Unix domain socket.
+	/// Each request frame is: uint32 flags (bit 0: return weights),
+	/// uint32 D and D values of T. Each response is: int32 y, int32 x,
+	/// T distance, followed by D values of T if weights were requested.
+	/// Values are in native byte order. A frame whose D differs from
+	/// the SOM closes the connection.
+	/// Throws if the server is stopped or already listening.
+	/// </summary>
+	/// <param name="socket_path">socket path, replaced if it exists.</param>
+	void listen(const std::string &socket_path)
+	{
+		std::lock_guard<std::mutex> listenLock(listenMtx);
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (stopping)
+			{
+				throw std::runtime_error("inference server is stopped");
+			}
+			if (acceptor.joinable())
+			{
+				throw std::runtime_error("inference server is already listening");
+			}
+		}
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (socket_path.size() >= sizeof(addr.sun_path))
+		{
+			throw std::runtime_error("socket path is too long");
+		}
+		std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+		::unlink(socket_path.c_str());
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 ||
+			::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+			::listen(fd, 64) != 0)
+		{
+			if (fd >= 0)
+				::close(fd);
+			throw std::runtime_error("cannot listen on " + socket_path);
+		}
+		std::lock_guard<std::mutex> lock(mtx);
+		// checked again, stop() may have run meanwhile.
+		if (stopping)
+		{
+			::close(fd);
+			::unlink(socket_path.c_str());
+			throw std::runtime_error("inference server is stopped");
+		}
+		listenFd = fd;
+		socketPath = socket_path;
+		acceptor = std::thread(&SOMInferenceServer::acceptLoop, this, fd);
+	}
+#endif
+
+	/// <summary>
+	/// stops accepting requests, answers the queued ones
+	/// and joins all threads.
+	/// </summary>
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (stopping)
+				return;
+			stopping = true;
+		}
+		cv.notify_all();
+#if SOM_SERVER_UNIX_SOCKET
+		if (listenFd >= 0)
+		{
+			::shutdown(listenFd, SHUT_RDWR);
+			::close(listenFd);
+			::unlink(socketPath.c_str());
+		}
+		if (acceptor.joinable())
+			acceptor.join();
+		{
+			// connection threads are detached, wait until all have exited.
+			std::unique_lock<std::mutex> lock(mtx);
+			for (int fd : clientFds)
+				::shutdown(fd, SHUT_RDWR);
+			connectionsCv.wait(lock, [this] { return activeConnections == 0; });
+		}
+#endif
+		for (std::thread &t : pool)
+			t.join();
+	}
+
+	/// <summary>
+	/// get #N of executed batches and answered requests.
+	/// </summary>
+	/// <param name="batches">#N of batches</param>
+	/// <param name="requests">#N of requests</param>
+	void counters(unsigned long long &batches, unsigned long long &requests) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		batches = nBatches;
+		requests = nRequests;
+	}
+
+	/// <summary>
+	/// in-process load generator. Client threads submit samples
+	/// (cyclically) at the given rates and wait for each answer,
+	/// like request threads of a service would.
+	/// </summary>
+	/// <param name="samples">samples to send</param>
+	/// <param name="clients">#N of client threads</param>
+	/// <param name="requestsPerClient">#N of requests per client and load level</param>
+	/// <param name="offeredQPS">total offered loads (requests/s) to measure,
+	///  0 means each client sends its next request as soon as it is answered.</param>
+	/// <returns>latency and throughput per load level.</returns>
+	std::vector<SOMLoadPoint> benchmark(const std::vector<std::vector<T>> &samples,
+										int clients, int requestsPerClient,
+										const std::vector<double> &offeredQPS)
+	{
+		// client threads must not throw, check everything up front.
+		if (samples.empty() || clients <= 0 || requestsPerClient <= 0)
+		{
+			throw std::invalid_argument("benchmark needs samples, clients and requests");
+		}
+		for (const std::vector<T> &sample : samples)
+		{
+			if (sample.size() != static_cast<size_t>(som.dims()))
+			{
+				throw std::invalid_argument("input sample has different size than SOM");
+			}
+		}
+		std::vector<SOMLoadPoint> points;
+		for (double qps : offeredQPS)
+		{
+			std::vector<std::vector<double>> latencies(clients);
+			unsigned long long b0, r0, b1, r1;
+			counters(b0, r0);
+			const Clock::time_point start = Clock::now();
+			std::vector<std::thread> threads;
+			for (int c = 0; c < clients; ++c)
+			{
+				threads.emplace_back([&, c]() {
+					std::chrono::duration<double> interval(qps > 0.0 ? clients / qps : 0.0);
+					Clock::time_point next = Clock::now();
+					latencies[c].reserve(requestsPerClient);
+					for (int r = 0; r < requestsPerClient; ++r)
+					{
+						if (qps > 0.0)
+						{
+							std::this_thread::sleep_until(next);
+							next += std::chrono::duration_cast<Clock::duration>(interval);
+						}
+						const Clock::time_point t0 = Clock::now();
+						submit(samples[(static_cast<size_t>(c) * requestsPerClient + r) % samples.size()]).get();
+						latencies[c].push_back(
+							std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+					}
+				});
+			}
+			for (std::thread &t : threads)
+				t.join();
+			const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			counters(b1, r1);
+
+			std::vector<double> all;
+			for (const std::vector<double> &l : latencies)
+				all.insert(all.end(), l.begin(), l.end());
+			std::sort(all.begin(), all.end());
+			SOMLoadPoint point;
+			point.offeredQPS = qps;
+			point.throughput = all.size() / elapsed;
+			if (!all.empty())
+			{
+				point.p50 = all[all.size() / 2];
+				point.p99 = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+			}
+			point.meanBatch = (b1 > b0) ? (r1 - r0) / static_cast<double>(b1 - b0) : 0.0;
+			points.push_back(point);
+		}
+		return points;
+	}
+
+  private:
+	typedef std::chrono::steady_clock Clock;
+
+	/// <summary>
+	/// queued request.
+	/// </summary>
+	struct Request
+	{
+		std::vector<T> sample;
+		bool withWeights;
+		Clock::time_point enqueued;
+		std::promise<SOMInferenceResult<T>> promise;
+	};
+
+	/// <summary>
+	/// worker loop: takes a batch when it is full or the oldest
+	/// request reached its deadline, then answers it.
+	/// </summary>
+	void work()
+	{
+		std::vector<Request> batch;
+		std::vector<const std::vector<T> *> samples;
+		std::vector<int> ys, xs;
+		std::vector<T> dists;
+		BMUPruningStats stats;
+		for (;;)
+		{
+			batch.clear();
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (queue.empty())
+					return;
+				const Clock::time_point due = queue.front().enqueued + deadline;
+				cv.wait_until(lock, due, [this] { return stopping || queue.size() >= maxBatch; });
+				const size_t n = std::min(maxBatch, queue.size());
+				for (size_t i = 0; i < n; ++i)
+				{
+					batch.push_back(std::move(queue.front()));
+					queue.pop_front();
+				}
+				// another worker may have emptied the queue meanwhile.
+				if (n > 0)
+				{
+					++nBatches;
+					nRequests += n;
+				}
+			}
+			if (batch.empty())
+				continue;
+			// wake another worker for the rest of the queue.
+			cv.notify_one();
+
+			samples.clear();
+			for (const Request &req : batch)
+				samples.push_back(&req.sample);
+			try
+			{
+				som.calcBestMatchingUnits(samples, ys, xs, dists, stats);
+			}
+			catch (...)
+			{
+				for (Request &req : batch)
+					req.promise.set_exception(std::current_exception());
+				continue;
+			}
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				SOMInferenceResult<T> res;
+				res.y = ys[i];
+				res.x = xs[i];
+				res.distance = dists[i];
+				if (batch[i].withWeights)
+				{
+					const T *node = som.nodeAt(ys[i], xs[i]);
+					res.weights.assign(node, node + batch[i].sample.size());
+				}
+				batch[i].promise.set_value(std::move(res));
+			}
+		}
+	}
+
+#if SOM_SERVER_UNIX_SOCKET
+	/// <summary>
+	/// reads or writes exactly len bytes.
+	/// </summary>
+	static bool readAll(int fd, void *buf, size_t len)
+	{
+		char *p = static_cast<char *>(buf);
+		while (len > 0)
+		{
+			ssize_t r = ::read(fd, p, len);
+			if (r <= 0)
+				return false;
+			p += r;
+			len -= r;
+		}
+		return true;
+	}
+	static bool writeAll(int fd, const void *buf, size_t len)
+	{
+		const char *p = static_cast<const char *>(buf);
+		while (len > 0)
+		{
+			ssize_t r = ::write(fd, p, len);
+			if (r <= 0)
+				return false;
+			p += r;
+			len -= r;
+		}
+		return true;
+	}
+
+	void acceptLoop(int fd)
+	{
+		for (;;)
+		{
+			int client = ::accept(fd, nullptr, nullptr);
+			if (client < 0)
+				return;
+			std::lock_guard<std::mutex> lock(mtx);
+			if (stopping)
+			{
+				::close(client);
+				return;
+			}
+			clientFds.push_back(client);
+			++activeConnections;
+			try
+			{
+				std::thread(&SOMInferenceServer::serveConnection, this, client).detach();
+			}
+			catch (const std::system_error &)
+			{
+				clientFds.pop_back();
+				--activeConnections;
+				::close(client);
+			}
+		}
+	}
+
+	void serveConnection(int fd)
+	{
+		try
+		{
+			std::vector<char> response;
+			for (;;)
+			{
+				uint32_t header[2];
+				if (!readAll(fd, header, sizeof(header)))
+					break;
+				// reject before allocating, D comes from the client.
+				if (header[1] != static_cast<uint32_t>(som.dims()))
+					break;
+				std::vector<T> sample(header[1]);
+				if (!readAll(fd, sample.data(), sample.size() * sizeof(T)))
+					break;
+				// throws if the server is stopped.
+				SOMInferenceResult<T> res = submit(std::move(sample), (header[0] & 1u) != 0).get();
+				int32_t yx[2] = {res.y, res.x};
+				response.resize(sizeof(yx) + sizeof(T) * (1 + res.weights.size()));
+				std::memcpy(response.data(), yx, sizeof(yx));
+				std::memcpy(response.data() + sizeof(yx), &res.distance, sizeof(T));
+				if (!res.weights.empty())
+				{
+					std::memcpy(response.data() + sizeof(yx) + sizeof(T),
+								res.weights.data(), res.weights.size() * sizeof(T));
+				}
+				if (!writeAll(fd, response.data(), response.size()))
+					break;
+			}
+		}
+		catch (const std::exception &)
+		{
+			// drop the connection, the thread must not terminate the process.
+		}
+		// last access to the server, stop() may return after this.
+		std::lock_guard<std::mutex> lock(mtx);
+		// closed under the lock, so the fd number can't be reused by
+		// acceptLoop() while it is still listed in clientFds.
+		clientFds.erase(std::remove(clientFds.begin(), clientFds.end(), fd), clientFds.end());
+		::close(fd);
+		--activeConnections;
+		connectionsCv.notify_all();
+	}
+#endif
+
+	/// <summary>
+	/// served SOM.
+	/// </summary>
+	const SOM<T> &som;
+
+	/// <summary>
+	/// max #N of samples per batch.
+	/// </summary>
+	const size_t maxBatch;
+
+	/// <summary>
+	/// max waiting time of a request for its batch to fill.
+	/// </summary>
+	const std::chrono::microseconds deadline;
+
+	mutable std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<Request> queue;
+	std::vector<std::thread> pool;
+	bool stopping = false;
+	unsigned long long nBatches = 0;
+	unsigned long long nRequests = 0;
+
+#if SOM_SERVER_UNIX_SOCKET
+	/// <summary>
+	/// serializes @listen() calls.
+	/// </summary>
+	std::mutex listenMtx;
+	int listenFd = -1;
+	std::string socketPath;
+	std::thread acceptor;
+	std::condition_variable connectionsCv;
+	int activeConnections = 0;
+	std::vector<int> clientFds;
+#endif
+};